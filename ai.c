@@ -0,0 +1,182 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file ai.c
+ * 
+ * \brief This file implements the ai paddle policies and presets declared
+ * in ai.h.
+ */
+
+#include "ai.h"
+
+/* known presets: the built-in ones first, then the ones loaded */
+static ai_policy presets[AI_MAX_PRESETS] = {
+    /* the original tracker: sees the ball at once, moves every tick */
+    {"classic", 0, 100, 0},
+    /* a model of a human player, opponent of the tuner */
+    {"human", 6, 80, 0},
+    /* imperfect on both sides, so soak matches come to an end */
+    {"soak", 0, 80, 0},
+    /* difficulty levels found by pong -T, with their win rate on 80x24 */
+    {"easy", 0, 76, 0}, /* 0.250 */
+    {"medium", 45, 75, 1}, /* 0.500 */
+    {"hard", 26, 36, 54}, /* 0.753 */
+    {"expert", 31, 64, 100}, /* 1.000 */
+};
+static int preset_count = 7;
+
+void ai_reset(ai_state *st, const game_data *data, unsigned int seed)
+{
+    int i;
+
+    for (i = 0; i < AI_HISTORY; ++i)
+    {
+        st->x[i] = data->ball_x;
+        st->y[i] = data->ball_y;
+        st->dirx[i] = data->ball_dirx;
+        st->diry[i] = data->ball_diry;
+    }
+    st->head = 0;
+    st->seed = seed;
+}
+
+/*
+ * Return the row where the ball is expected after the given ticks, 
+ * reflecting it on the field top and bottom like ball_step does. The 
+ * prediction stops when the ball reaches the paddle column.
+ */
+static int predict_row(const game_data *data, int x, int y, 
+        int dirx, int diry, int depth, int col)
+{
+    int i;
+
+    for (i = 0; i < depth && x != col; ++i)
+    {
+        x += dirx;
+        y += diry;
+        if (y < FIELD_TOP || y > data->bottom_row)
+        {
+            diry *= -1;
+            y += 2 * diry;
+        }
+    }
+
+    return y;
+}
+
+/*!
+ * The policy records the ball as it is now, but steers toward the 
+ * position predicted from the ball as it was reaction ticks ago. With 
+ * reaction and depth zero and full speed this is the original tracker.
+ */
+void ai_move(const ai_policy *p, ai_state *st, game_data *data, int side)
+{
+    int *pos = side == AI_SIDE ? &data->ai_paddle_pos : &data->paddle_pos;
+    int *old = side == AI_SIDE 
+        ? &data->ai_paddle_pos_old : &data->paddle_pos_old;
+    int col = side == AI_SIDE ? data->ai_paddle_col : data->paddle_col;
+    int seen; /* history slot of the ball as seen by the policy */
+    int diff; /* distance from the target row */
+    int new; /* new paddle position */
+
+    /* remember the ball as it is now; in multi-ball mode, the lead ball
+     * of the paddle */
+    st->head = (st->head + 1) % AI_HISTORY;
+    if (data->opt.balls)
+    {
+        st->x[st->head] = data->pool.lead[side].x;
+        st->y[st->head] = data->pool.lead[side].y;
+        st->dirx[st->head] = data->pool.lead[side].dirx;
+        st->diry[st->head] = data->pool.lead[side].diry;
+    } else {
+        st->x[st->head] = data->ball_x;
+        st->y[st->head] = data->ball_y;
+        st->dirx[st->head] = data->ball_dirx;
+        st->diry[st->head] = data->ball_diry;
+    }
+    seen = (st->head + AI_HISTORY - MIN(p->reaction, AI_MAX_REACTION)) 
+        % AI_HISTORY;
+
+    *old = *pos;
+
+    /* move toward the target on a share of the ticks */
+    if ((int) (rand_r(&st->seed) % 100) >= p->speed)
+        return;
+
+    diff = predict_row(data, st->x[seen], st->y[seen], st->dirx[seen], 
+            st->diry[seen], p->depth, col) - *pos;
+    new = *pos + diff / (diff == 0 ? 1 : abs(diff));
+
+    if (new >= PADDLE_WIDTH / 2 
+            && new <= data->bottom_row - PADDLE_WIDTH / 2)
+        *pos = new;
+}
+
+int ai_find_preset(const char *name, ai_policy *p)
+{
+    int i;
+
+    for (i = 0; i < preset_count; ++i)
+        if (!strcmp(presets[i].name, name))
+        {
+            *p = presets[i];
+            return 0;
+        }
+
+    return -1;
+}
+
+/*!
+ * The file has a preset per line, as "name reaction speed depth"; 
+ * anything after a '#' is a comment. Values are clamped to their range.
+ */
+int ai_load_presets(const char *path)
+{
+    char line[256];
+    ai_policy p;
+    FILE *f;
+    int i;
+
+    if (!(f = fopen(path, "r")))
+        return -1;
+
+    while (fgets(line, sizeof line, f))
+    {
+        *strchrnul(line, '#') = '\0';
+        if (sscanf(line, "%15s %d %d %d", 
+                    p.name, &p.reaction, &p.speed, &p.depth) != 4)
+            continue;
+
+        p.reaction = MAX(0, MIN(p.reaction, AI_MAX_REACTION));
+        p.speed = MAX(0, MIN(p.speed, 100));
+        p.depth = MAX(0, MIN(p.depth, AI_MAX_DEPTH));
+
+        /* replace a preset with the same name, or append */
+        for (i = 0; i < preset_count; ++i)
+            if (!strcmp(presets[i].name, p.name))
+                break;
+        if (i == AI_MAX_PRESETS)
+            break;
+        presets[i] = p;
+        preset_count = MAX(preset_count, i + 1);
+    }
+
+    fclose(f);
+
+    return 0;
+}
@@ -0,0 +1,102 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file ai.h
+ * 
+ * \brief This file declares the ai paddle policies, their difficulty 
+ * presets and the self-play tuner which searches for them.
+ */
+
+#ifndef AI_H
+#define AI_H
+
+#include "support.h"
+
+#define AI_HISTORY 64 /*!< ball positions remembered, > max reaction */
+#define AI_MAX_REACTION (AI_HISTORY - 1) /*!< max reaction in ticks */
+#define AI_MAX_DEPTH 200 /*!< max prediction depth in ticks */
+#define AI_MAX_PRESETS 32 /*!< max number of known presets */
+#define AI_SIDE 0 /*!< the policy drives the ai paddle */
+#define PLAYER_SIDE 1 /*!< the policy drives the player paddle */
+
+/*!
+ * State of a policy driving a paddle during a game
+ */
+typedef struct {
+    int x[AI_HISTORY]; /*!< ball x in the last ticks */
+    int y[AI_HISTORY]; /*!< ball y in the last ticks */
+    int dirx[AI_HISTORY]; /*!< ball x direction in the last ticks */
+    int diry[AI_HISTORY]; /*!< ball y direction in the last ticks */
+    int head; /*!< slot of the latest tick */
+    unsigned int seed; /*!< random seed for the tracking speed */
+} ai_state;
+
+/*!
+ * \brief Prepare the state of a policy for a new game, as if the ball had
+ * always been in its starting position.
+ *
+ * @param st policy state
+ * @param data game_data structure, with the field set up
+ * @param seed random seed
+ */
+void ai_reset(ai_state *st, const game_data *data, unsigned int seed);
+
+/*!
+ * \brief Move a paddle by one tick according to a policy.
+ *
+ * @param p policy
+ * @param st policy state
+ * @param data game_data structure
+ * @param side paddle driven (AI_SIDE or PLAYER_SIDE)
+ */
+void ai_move(const ai_policy *p, ai_state *st, game_data *data, int side);
+
+/*!
+ * \brief Find a preset by name.
+ *
+ * @param name preset name
+ * @param p filled with the preset found
+ * @return 0 on success, -1 if there is no such preset
+ */
+int ai_find_preset(const char *name, ai_policy *p);
+
+/*!
+ * \brief Load presets from a file written by ai_tune. Presets with the 
+ * name of a known one replace it.
+ *
+ * @param path presets file
+ * @return 0 on success, -1 on error
+ */
+int ai_load_presets(const char *path);
+
+/*!
+ * \brief Search the difficulty presets with parallel self-play, and save
+ * them into a presets file.
+ *
+ * Each candidate policy plays, as the ai, thousands of headless matches 
+ * against a fixed policy modelling a human player; an evolution strategy
+ * then moves the search toward the win rate of each difficulty level.
+ * Matches are spread on all the online cpus and the throughput is 
+ * reported on stderr.
+ *
+ * @param path presets file to write
+ * @return 0 on success, -1 on error
+ */
+int ai_tune(const char *path);
+
+#endif /* AI_H */
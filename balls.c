@@ -0,0 +1,458 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file balls.c
+ * 
+ * \brief This file implements the ball pool declared in balls.h.
+ */
+
+#include <limits.h>
+#include <time.h>
+#include <math.h>
+#include "balls.h"
+#include "ai.h"
+
+/* neighbour cells visited for ball-ball collisions: the cell itself is
+ * handled apart, the other half of the neighbourhood visits this one */
+static const int neighbour[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+
+int pool_init(ball_pool *pool, int capacity, int collide)
+{
+    memset(pool, 0, sizeof *pool);
+    pool->capacity = capacity;
+    pool->collide = collide;
+    pool->ball = malloc(capacity * sizeof *pool->ball);
+    pool->cell_ball = malloc(capacity * sizeof *pool->cell_ball);
+    pool->ball_cell = malloc(capacity * sizeof *pool->ball_cell);
+    pool->drawn_x = malloc(capacity * sizeof *pool->drawn_x);
+    pool->drawn_y = malloc(capacity * sizeof *pool->drawn_y);
+
+    if (!pool->ball || !pool->cell_ball || !pool->ball_cell 
+            || !pool->drawn_x || !pool->drawn_y)
+    {
+        pool_free(pool);
+        return -1;
+    }
+
+    return 0;
+}
+
+void pool_free(ball_pool *pool)
+{
+    free(pool->ball);
+    free(pool->cell_ball);
+    free(pool->ball_cell);
+    free(pool->drawn_x);
+    free(pool->drawn_y);
+    free(pool->mask);
+    free(pool->cell_start);
+    memset(pool, 0, sizeof *pool);
+}
+
+/*!
+ * Cells are twice the size of a ball, so that a ball only meets the balls
+ * of its cell and of the neighbour ones, and grow only when the grid 
+ * would pass POOL_MAX_CELLS. Buffers only grow.
+ */
+int pool_layout(game_data *data, int cells)
+{
+    ball_pool *pool = &data->pool;
+    unsigned char *mask;
+    int *start;
+    int size = POOL_CELL_SIZE; /* cell side */
+    int cols, rows; /* grid size */
+
+    do
+    {
+        cols = data->paddle_col / size + 1;
+        rows = data->bottom_row / size + 1;
+        size *= 2;
+    } while ((long) cols * rows > POOL_MAX_CELLS);
+    size /= 2;
+
+    if (cols * rows + 1 > pool->cells_size)
+    {
+        if (!(start = realloc(pool->cell_start, 
+                        (cols * rows + 1) * sizeof *start)))
+            return -1;
+        pool->cell_start = start;
+        pool->cells_size = cols * rows + 1;
+    }
+
+    if (cells > pool->mask_size)
+    {
+        if (!(mask = realloc(pool->mask, cells)))
+            return -1;
+        memset(mask, 0, cells);
+        pool->mask = mask;
+        pool->mask_size = cells;
+    }
+
+    /* the grid changes only once its buffer is there */
+    pool->cell_size = size;
+    pool->grid_cols = cols;
+    pool->grid_rows = rows;
+
+    return 0;
+}
+
+/*
+ * Put a ball in a random position with a random direction: in a game, in
+ * the middle third of the field, so that no ball is lost at once; in the
+ * benchmark, anywhere between the paddles, so that density is uniform.
+ */
+static void spawn(game_data *data, ball_state *b)
+{
+    unsigned int *seed = &data->pool.seed;
+    int span = data->paddle_col - data->ai_paddle_col - 1;
+    int lo = data->pool.respawn ? 0 : span / 3; /* first column, offset */
+    int width = data->pool.respawn ? span : span / 3 + 1; /* columns */
+
+    b->x = data->ai_paddle_col + 1 + lo + rand_r(seed) % MAX(width, 1);
+    b->y = FIELD_TOP + rand_r(seed) % (data->bottom_row - FIELD_TOP + 1);
+    b->dirx = rand_r(seed) % 2 == 0 ? 1 : -1;
+    b->diry = rand_r(seed) % 2 == 0 ? 1 : -1;
+}
+
+/*
+ * Return the index of the ball a paddle should follow: the nearest one 
+ * moving toward it or, when none is, the nearest one. Return -1 for an 
+ * empty pool.
+ */
+static int find_lead(const game_data *data, int side)
+{
+    const ball_pool *pool = &data->pool;
+    const ball_state *b;
+    int best = INT_MAX; /* distance of the lead ball from the paddle */
+    int lead = -1;
+    int approaching = 0; /* the lead ball moves toward the paddle */
+    int toward;
+    int t;
+    int i;
+
+    for (i = 0; i < pool->count; ++i)
+    {
+        b = &pool->ball[i];
+        t = side == AI_SIDE 
+            ? b->x - data->ai_paddle_col : data->paddle_col - b->x;
+        toward = side == AI_SIDE ? b->dirx < 0 : b->dirx > 0;
+        if ((toward && !approaching) || (toward == approaching && t < best))
+        {
+            best = t;
+            lead = i;
+            approaching = toward;
+        }
+    }
+
+    return lead;
+}
+
+/*
+ * Choose the lead ball of each paddle. The ball fields of game_data are
+ * set to the lead of the ai.
+ */
+static void set_lead(game_data *data)
+{
+    ball_pool *pool = &data->pool;
+    int i;
+
+    if ((i = find_lead(data, PLAYER_SIDE)) >= 0)
+        pool->lead[PLAYER_SIDE] = pool->ball[i];
+    if ((i = find_lead(data, AI_SIDE)) < 0)
+        return;
+    pool->lead[AI_SIDE] = pool->ball[i];
+
+    data->ball_x_old = data->ball_x;
+    data->ball_y_old = data->ball_y;
+    data->ball_x = pool->ball[i].x;
+    data->ball_y = pool->ball[i].y;
+    data->ball_dirx = pool->ball[i].dirx;
+    data->ball_diry = pool->ball[i].diry;
+}
+
+void pool_reset(game_data *data, unsigned int seed)
+{
+    ball_pool *pool = &data->pool;
+    int i;
+
+    pool->seed = seed;
+    pool->count = pool->capacity;
+    pool->lost[0] = pool->lost[1] = 0;
+    for (i = 0; i < pool->count; ++i)
+        spawn(data, &pool->ball[i]);
+
+    set_lead(data);
+    data->ball_x_old = data->ball_x;
+    data->ball_y_old = data->ball_y;
+}
+
+/*
+ * Grid cell of a field position.
+ */
+static int cell_of(const ball_pool *pool, int x, int y)
+{
+    return MIN(y / pool->cell_size, pool->grid_rows - 1) * pool->grid_cols
+        + MIN(x / pool->cell_size, pool->grid_cols - 1);
+}
+
+/*
+ * Rebuild the spatial hash with a counting sort of the balls by cell.
+ */
+static void build_hash(ball_pool *pool)
+{
+    int *start = pool->cell_start;
+    int cells = pool->grid_cols * pool->grid_rows;
+    int c;
+    int i;
+
+    memset(start, 0, (cells + 1) * sizeof *start);
+    for (i = 0; i < pool->count; ++i)
+    {
+        pool->ball_cell[i] = cell_of(pool, pool->ball[i].x, pool->ball[i].y);
+        start[pool->ball_cell[i] + 1]++;
+    }
+    for (c = 0; c < cells; ++c)
+        start[c + 1] += start[c];
+
+    /* placing a ball advances the start of its cell to the next one, so 
+     * the starts are shifted back afterwards */
+    for (i = 0; i < pool->count; ++i)
+        pool->cell_ball[start[pool->ball_cell[i]]++] = i;
+    for (c = cells; c > 0; --c)
+        start[c] = start[c - 1];
+    start[0] = 0;
+}
+
+/*
+ * Reflect the balls which reached a paddle column, or mark them out. Only
+ * the grid column holding the paddle is visited. Return the winner of 
+ * the last ball out, or -1 if no ball got out.
+ */
+static int hit_paddle(game_data *data, int player)
+{
+    ball_pool *pool = &data->pool;
+    int col = player ? data->paddle_col : data->ai_paddle_col;
+    int pos = player ? data->paddle_pos : data->ai_paddle_pos;
+    int gx = MIN(col / pool->cell_size, pool->grid_cols - 1);
+    int winner = -1;
+    ball_state *b;
+    int gy;
+    int k;
+
+    for (gy = 0; gy < pool->grid_rows; ++gy)
+    {
+        int c = gy * pool->grid_cols + gx;
+
+        for (k = pool->cell_start[c]; k < pool->cell_start[c + 1]; ++k)
+        {
+            b = &pool->ball[pool->cell_ball[k]];
+            if (player ? b->x < col : b->x > col)
+                continue;
+
+            if (abs(pos - b->y - -b->diry) <= PADDLE_WIDTH / 2)
+            {
+                /* same rule of ball_step, one extra on length because the
+                 * ball is moving diagonally */
+                b->dirx *= -1;
+                b->x = col + 2 * b->dirx;
+            } else {
+                /* ball is out */
+                b->dirx = 0;
+                winner = player;
+                pool->lost[!player]++;
+            }
+        }
+    }
+
+    return winner;
+}
+
+/*
+ * Exchange the directions of two balls touching and moving toward each 
+ * other, as for an elastic collision between equal masses.
+ */
+static void bounce(ball_state *a, ball_state *b)
+{
+    int dx = b->x - a->x;
+    int dy = b->y - a->y;
+    int t;
+
+    if (abs(dx) > 1 || abs(dy) > 1 || !a->dirx || !b->dirx)
+        return;
+    if (dx * (b->dirx - a->dirx) + dy * (b->diry - a->diry) >= 0)
+        return;
+
+    t = a->dirx; a->dirx = b->dirx; b->dirx = t;
+    t = a->diry; a->diry = b->diry; b->diry = t;
+}
+
+/*
+ * Collide the balls of each cell with the ones in the same cell and in 
+ * half of the neighbour cells, so that each pair is tested once.
+ */
+static void collide(ball_pool *pool)
+{
+    ball_state *b = pool->ball;
+    const int *start = pool->cell_start;
+    const int *idx = pool->cell_ball;
+    int gx, gy, nx, ny;
+    int c, n;
+    int i, j, k;
+
+    for (gy = 0; gy < pool->grid_rows; ++gy)
+        for (gx = 0; gx < pool->grid_cols; ++gx)
+        {
+            c = gy * pool->grid_cols + gx;
+            for (i = start[c]; i < start[c + 1]; ++i)
+            {
+                for (j = i + 1; j < start[c + 1]; ++j)
+                    bounce(&b[idx[i]], &b[idx[j]]);
+
+                for (k = 0; k < 4; ++k)
+                {
+                    nx = gx + neighbour[k][0];
+                    ny = gy + neighbour[k][1];
+                    if (nx < 0 || nx >= pool->grid_cols 
+                            || ny >= pool->grid_rows)
+                        continue;
+                    n = ny * pool->grid_cols + nx;
+                    for (j = start[n]; j < start[n + 1]; ++j)
+                        bounce(&b[idx[i]], &b[idx[j]]);
+                }
+            }
+        }
+}
+
+/*!
+ * A tick visits each ball a constant number of times: move, hash, paddle
+ * check for the balls in the paddle columns, and removal. Ball-ball 
+ * collisions only test pairs in neighbour cells.
+ */
+int pool_step(game_data *data)
+{
+    ball_pool *pool = &data->pool;
+    ball_state *b;
+    int last = -1; /* winner of the last ball out */
+    int w;
+    int i;
+
+    /* move balls, reflecting them on field top and bottom */
+    for (i = 0; i < pool->count; ++i)
+    {
+        b = &pool->ball[i];
+        b->x += b->dirx;
+        b->y += b->diry;
+        if (b->y < FIELD_TOP || b->y > data->bottom_row)
+        {
+            b->diry *= -1;
+            b->y += 2 * b->diry;
+        }
+    }
+
+    build_hash(pool);
+
+    if ((w = hit_paddle(data, 1)) >= 0)
+        last = w;
+    if ((w = hit_paddle(data, 0)) >= 0)
+        last = w;
+
+    if (pool->collide)
+        collide(pool);
+
+    /* remove the balls out, moving the last ball into their slot */
+    for (i = 0; i < pool->count; )
+    {
+        b = &pool->ball[i];
+        if (b->dirx)
+            ++i;
+        else if (pool->respawn)
+            spawn(data, b);
+        else
+            *b = pool->ball[--pool->count];
+    }
+
+    if (pool->count == 0)
+    {
+        data->winner = pool->lost[0] != pool->lost[1]
+            ? pool->lost[0] > pool->lost[1] : last;
+        return BALL_OUT;
+    }
+
+    set_lead(data);
+
+    return BALL_IN;
+}
+
+int pool_bench(FILE *out)
+{
+    static game_data data; /* headless field */
+    struct timespec start, now;
+    double scale; /* field side over the smallest field side */
+    long ticks;
+    long us;
+    int collide;
+    int n;
+
+    fprintf(out, "multi-ball tick cost, %d field cells per ball:\n"
+            "  %7s %11s %8s %10s %9s %8s\n", BENCH_BALL_AREA,
+            "balls", "field", "collide", "us/tick", "ns/ball", "ticks");
+
+    for (collide = 0; collide < 2; ++collide)
+        for (n = 1; n <= BENCH_MAX_BALLS; n *= 10)
+        {
+            /* grow the field with the balls, keeping their density */
+            scale = MAX(1.0, sqrt((double) n * BENCH_BALL_AREA 
+                        / (BENCH_COLS * BENCH_ROWS)));
+            memset(&data, 0, sizeof data);
+            data.paddle_col = (int) (BENCH_COLS * scale) - 1;
+            data.ai_paddle_col = 1;
+            data.bottom_row = (int) (BENCH_ROWS * scale) - 1;
+            data.paddle_pos = data.ai_paddle_pos = data.bottom_row / 2;
+            if (pool_init(&data.pool, n, collide))
+                return -1;
+            data.pool.respawn = 1;
+            if (pool_layout(&data, 0))
+            {
+                pool_free(&data.pool);
+                return -1;
+            }
+            pool_reset(&data, n);
+
+            /* read the clock every few ticks, to keep it out of the cost
+             * of small pools */
+            ticks = us = 0;
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            do
+            {
+                pool_step(&data);
+                if (++ticks % BENCH_BATCH == 0)
+                {
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    us = elapsed_us(&start, &now);
+                }
+            } while (ticks % BENCH_BATCH || us < BENCH_MIN_US);
+
+            fprintf(out, "  %7d %5dx%-5d %8s %10.2f %9.1f %8ld\n", n, 
+                    data.paddle_col + 1, data.bottom_row + 1,
+                    collide ? "yes" : "no", (double) us / ticks, 
+                    1000.0 * us / ticks / n, ticks);
+            pool_free(&data.pool);
+        }
+
+    return 0;
+}
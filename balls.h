@@ -0,0 +1,101 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file balls.h
+ * 
+ * \brief This file declares the ball pool of the multi-ball mode and its
+ * scaling benchmark.
+ */
+
+#ifndef BALLS_H
+#define BALLS_H
+
+#include "support.h"
+
+#define BENCH_COLS 200 /*!< columns of the smallest benchmark field */
+#define BENCH_ROWS 60 /*!< rows of the smallest benchmark field */
+#define BENCH_BALL_AREA 32 /*!< benchmark field cells per ball */
+#define BENCH_MAX_BALLS 100000 /*!< largest ball count benchmarked */
+#define BENCH_BATCH 16 /*!< ticks between clock reads */
+#define BENCH_MIN_US 200000 /*!< min time in us measured per ball count */
+
+/*!
+ * \brief Allocate a pool.
+ *
+ * @param pool ball pool
+ * @param capacity number of balls
+ * @param collide enable ball-ball collisions
+ * @return 0 on success, -1 if memory is exhausted
+ */
+int pool_init(ball_pool *pool, int capacity, int collide);
+
+/*!
+ * \brief Free the memory of a pool.
+ *
+ * @param pool ball pool
+ */
+void pool_free(ball_pool *pool);
+
+/*!
+ * \brief Fit the spatial hash to the current field size, and the buffer of
+ * the high resolution renderer to the screen. Must be called on each new
+ * layout.
+ *
+ * @param data game_data structure, with the field set up
+ * @param cells screen cells, or 0 when nothing is rendered
+ * @return 0 on success, -1 if memory is exhausted, in which case the grid
+ * is left as it was and the pool must not be stepped on the new field
+ */
+int pool_layout(game_data *data, int cells);
+
+/*!
+ * \brief Spawn all the balls of the pool in the middle of the field, with
+ * random directions.
+ *
+ * @param data game_data structure, with the field set up
+ * @param seed random seed
+ */
+void pool_reset(game_data *data, unsigned int seed);
+
+/*!
+ * \brief Advance all the balls of the pool by one tick.
+ *
+ * Balls are reflected on borders, paddles and, if enabled, on each other;
+ * balls which get out leave the pool. Each paddle gets a lead ball to 
+ * follow, the nearest one moving toward it; the ball fields of game_data
+ * are set to the lead of the ai. When the last ball gets out, the winner 
+ * is the side which missed fewer balls, or the one which did not miss the
+ * last.
+ *
+ * @param data game_data structure
+ * @return BALL_IN, or BALL_OUT when the game is over
+ */
+int pool_step(game_data *data);
+
+/*!
+ * \brief Measure the cost of a tick for growing ball counts, with and 
+ * without ball-ball collisions, on a headless field which grows with the
+ * balls, so that their density stays constant. Balls which get out 
+ * respawn, so that the count stays constant.
+ *
+ * @param out output stream
+ * @return 0 on success, -1 if memory is exhausted
+ */
+int pool_bench(FILE *out);
+
+#endif /* BALLS_H */
@@ -0,0 +1,294 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file metrics.c
+ * 
+ * \brief This file implements the metrics server declared in metrics.h.
+ */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <time.h>
+#include "metrics.h"
+#include "stats.h"
+
+#define METRICS_MAX 32 /* max metrics in a snapshot */
+
+/*
+ * A value of the snapshot.
+ */
+typedef struct {
+    const char *name; /* name, without the pong_ prefix */
+    const char *type; /* Prometheus type (counter or gauge) */
+    const char *help; /* description */
+    double value; /* value */
+} metric;
+
+int metrics_open(const char *path)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    int fd;
+    int err;
+
+    if (strlen(path) >= sizeof addr.sun_path)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if ((fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) == -1)
+        return -1;
+
+    /* replace a socket left by a previous run, but neither another kind 
+     * of file nor the socket of a running instance */
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    {
+        if (connect(fd, (struct sockaddr*) &addr, sizeof addr) == 0)
+        {
+            close(fd);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr*) &addr, sizeof addr) == -1
+            || listen(fd, METRICS_BACKLOG) == -1)
+    {
+        err = errno;
+        close(fd);
+        errno = err;
+        return -1;
+    }
+
+    return fd;
+}
+
+void metrics_close(int fd, const char *path)
+{
+    close(fd);
+    unlink(path);
+}
+
+/*
+ * Fill a metric of the snapshot.
+ */
+static void set(metric *m, const char *name, const char *type, 
+        const char *help, double value)
+{
+    m->name = name;
+    m->type = type;
+    m->help = help;
+    m->value = value;
+}
+
+/*
+ * Load a counter updated with relaxed ordering.
+ */
+static long load(atomic_long *counter)
+{
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+/*
+ * Take the snapshot. Rates are left to the scraper, which derives them 
+ * from the counters over its own window: the server keeps no state, so 
+ * that concurrent scrapers do not disturb each other. Return the number 
+ * of metrics.
+ */
+static int collect(game_data *data, metric *m)
+{
+    struct timespec now;
+    int depth = 0; /* bytes waiting in the pipe */
+    int n = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ioctl(data->pipedes[0], FIONREAD, &depth);
+
+    set(&m[n++], "uptime_seconds", "gauge", 
+            "Time since the game started",
+            elapsed_us(&stats.start, &now) / 1e6);
+    set(&m[n++], "tick_interval_seconds", "gauge", 
+            "Time between ball ticks",
+            data->tick_us / 1e6);
+    set(&m[n++], "ticks_total", "counter", 
+            "Wake ups of the ball thread",
+            load(&stats.ticks));
+    set(&m[n++], "tick_lateness_seconds_total", "counter", 
+            "Lateness of the ball thread wake ups, summed",
+            load(&stats.tick_late_us) / 1e6);
+    set(&m[n++], "tick_lateness_max_seconds", "gauge", 
+            "Max lateness of a wake up",
+            load(&stats.tick_late_max_us) / 1e6);
+    set(&m[n++], "events_total", "counter", 
+            "Messages received by the main loop",
+            load(&stats.pipe_messages));
+    set(&m[n++], "frames_total", "counter", 
+            "Ball frames rendered by the main loop",
+            load(&stats.frames));
+    set(&m[n++], "frames_dropped_total", "counter", 
+            "Ball frames rendered late or skipped",
+            load(&stats.frames_dropped));
+    set(&m[n++], "pipe_depth_messages", "gauge", 
+            "Messages waiting in the pipe to the main loop",
+            depth / TAG_SIZE);
+    set(&m[n++], "mutex_acquisitions_total", "counter", 
+            "Acquisitions of the game mutex",
+            load(&stats.lock_count));
+    set(&m[n++], "mutex_contended_total", "counter", 
+            "Acquisitions of the game mutex which had to wait",
+            load(&stats.lock_contended));
+    set(&m[n++], "mutex_wait_seconds_total", "counter", 
+            "Time spent waiting for the game mutex",
+            load(&stats.lock_wait_ns) / 1e9);
+    set(&m[n++], "terminal_bytes_total", "counter", 
+            "Bytes written to the terminal by the main loop",
+            stats_terminal_bytes());
+    set(&m[n++], "matches_won_total", "counter", 
+            "Matches won by the player",
+            load(&stats.matches_won));
+    set(&m[n++], "matches_lost_total", "counter", 
+            "Matches won by the ai",
+            load(&stats.matches_lost));
+    set(&m[n++], "balls", "gauge", 
+            "Balls in play at the last tick",
+            atomic_load_explicit(&stats.balls, memory_order_relaxed));
+
+    return n;
+}
+
+/*
+ * Write the snapshot into body, in Prometheus text format or in JSON.
+ * Return its length.
+ */
+static int format(game_data *data, char *body, int json)
+{
+    metric m[METRICS_MAX];
+    int count = collect(data, m);
+    int len = 0;
+    int i;
+
+    if (json)
+        len += snprintf(body + len, METRICS_BODY_SIZE - len, "{");
+    for (i = 0; i < count && len < METRICS_BODY_SIZE; ++i)
+        if (json)
+            len += snprintf(body + len, METRICS_BODY_SIZE - len, 
+                    "%s\n  \"%s\": %.15g", i ? "," : "",
+                    m[i].name, m[i].value);
+        else
+            len += snprintf(body + len, METRICS_BODY_SIZE - len,
+                    "# HELP pong_%s %s.\n# TYPE pong_%s %s\npong_%s %.15g\n",
+                    m[i].name, m[i].help, m[i].name, m[i].type, 
+                    m[i].name, m[i].value);
+    if (json && len < METRICS_BODY_SIZE)
+        len += snprintf(body + len, METRICS_BODY_SIZE - len, "\n}\n");
+
+    return MIN(len, METRICS_BODY_SIZE - 1);
+}
+
+/*
+ * Write a whole buffer to a client, giving up if it goes away.
+ */
+static void send_all(int fd, const char *buf, int len)
+{
+    ssize_t n;
+
+    while (len > 0 && (n = send(fd, buf, len, MSG_NOSIGNAL)) > 0)
+    {
+        buf += n;
+        len -= n;
+    }
+}
+
+/*
+ * Serve a snapshot to a client.
+ */
+static void serve(game_data *data, int fd)
+{
+    char req[METRICS_REQUEST_SIZE]; /* start of the request */
+    char body[METRICS_BODY_SIZE]; /* the snapshot */
+    char head[160]; /* HTTP response header */
+    struct pollfd pfd;
+    ssize_t n = 0;
+    int json;
+    int len;
+
+    /* a client may send no request and just read */
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    if (poll(&pfd, 1, METRICS_TIMEOUT) > 0)
+        n = read(fd, req, sizeof req - 1);
+    req[MAX(n, 0)] = '\0';
+    json = strstr(req, "json") != NULL;
+
+    len = format(data, body, json);
+    if (!strncmp(req, "GET ", 4))
+        send_all(fd, head, snprintf(head, sizeof head, 
+                    "HTTP/1.0 200 OK\r\n"
+                    "Content-Type: %s\r\n"
+                    "Content-Length: %d\r\n"
+                    "Connection: close\r\n\r\n",
+                    json ? "application/json" : "text/plain; version=0.0.4",
+                    len));
+    send_all(fd, body, len);
+}
+
+/*!
+ * Shutting down a listening socket makes accept fail with EINVAL, and 
+ * wakes up a thread blocked on it.
+ */
+void metrics_stop(int fd)
+{
+    shutdown(fd, SHUT_RDWR);
+}
+
+/*!
+ * The thread sleeps in accept until a connection comes, or until 
+ * metrics_stop shuts the socket down, so that it wakes up only to serve.
+ */
+void *metrics_server(void *d)
+{
+    game_data *data = (game_data*) d;
+    int fd;
+
+    stats_thread_start(THREAD_METRICS);
+
+    for (;;)
+    {
+        fd = accept4(data->metrics_fd, NULL, NULL, SOCK_CLOEXEC);
+        stats_wakeup(THREAD_METRICS);
+        if (fd == -1)
+        {
+            if (errno == EINVAL)
+                break; /* shut down by metrics_stop */
+            continue;
+        }
+        serve(data, fd);
+        close(fd);
+    }
+
+    stats_thread_stop(THREAD_METRICS);
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file metrics.h
+ * 
+ * \brief This file declares the metrics server, which serves a snapshot 
+ * of the game counters on a Unix domain socket.
+ *
+ * The snapshot is in Prometheus text format, or in JSON when the request
+ * contains "json". A request starting with "GET " gets an HTTP response, 
+ * so that the socket can be scraped through HTTP; any other request, or
+ * none, gets the bare snapshot. The server only reads the counters the 
+ * game threads update with relaxed atomics.
+ */
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "support.h"
+
+#define METRICS_BACKLOG 8 /*!< pending connections on the socket */
+#define METRICS_TIMEOUT 100 /*!< time in ms waiting for a request */
+#define METRICS_REQUEST_SIZE 512 /*!< max bytes of a request read */
+#define METRICS_BODY_SIZE 8192 /*!< max bytes of a snapshot */
+
+/*!
+ * \brief Create the listening socket. A stale socket file left on the 
+ * path is replaced.
+ *
+ * @param path socket path
+ * @return socket file descriptor, -1 on error (errno is set)
+ */
+int metrics_open(const char *path);
+
+/*!
+ * \brief Close the listening socket and remove its file.
+ *
+ * @param fd socket file descriptor
+ * @param path socket path
+ */
+void metrics_close(int fd, const char *path);
+
+/*!
+ * \brief Stop accepting connections, waking up the metrics server.
+ *
+ * @param fd socket file descriptor
+ */
+void metrics_stop(int fd);
+
+/*!
+ * \brief Thread function for the metrics server.
+ *
+ * Serve a snapshot to each connection on metrics_fd of game_data, one at
+ * a time. The thread terminates once metrics_stop is called.
+ *
+ * @param d shared game_data structure
+ */
+void *metrics_server(void *d);
+
+#endif /* METRICS_H */
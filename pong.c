@@ -23,10 +23,12 @@
  *
  * The game main thread act as a controller, receiving data from three 
  * children threads: one for the keyboard input handling, one controlling the
- * ball position and one for the ai moves. Another thread is used as signal
- * listener, handling kill/int/term and terminal resize signals. Signals are 
- * blocked during program initialization and then managed with a signal file 
- * descriptor and a poll from the kernel. Thread comunication is provided 
+ * ball position and one for the ai moves. The children threads live for
+ * the whole program, and ball and ai threads are parked between games. 
+ * Another thread is used as signal listener, handling kill/int/term and 
+ * terminal resize signals. Signals are blocked during program 
+ * initialization and then managed with a signal file descriptor and a 
+ * poll from the kernel. Thread comunication is provided 
  * with a pipe.
  *
  * Note that ncurses is not thread safe, so operations on the window
@@ -50,22 +52,295 @@
 #include <pthread.h>
 #include <string.h>
 #include <stdio.h>
+#include <locale.h>
+#include <langinfo.h>
+#include <errno.h>
 #include "support.h"
+#include "realtime.h"
+#include "stats.h"
+#include "ai.h"
+#include "balls.h"
+#include "metrics.h"
 
 /* global variables for keyboard delay and rate settings */
 char del[4];
 char rate[3];
 
-int main(void)
+/* game data to be reported on at program exit */
+static game_data *report_data;
+
+/*
+ * Print the reports requested on the command line. Registered with atexit,
+ * so it runs both on normal exit and from termination_handler, after the
+ * ncurses window has been closed.
+ */
+static void print_reports(void)
+{
+    if (report_data->opt.jitter_report)
+        jitter_report(stderr, &report_data->opt, report_data->tick_us);
+    if (report_data->opt.stats_summary)
+        stats_summary(stderr);
+    if (report_data->opt.soak_matches)
+        stats_soak_report(stderr);
+}
+
+/*
+ * Close the metrics socket and remove its path. Registered with atexit 
+ * once the socket is open, so that termination_handler, which exits from
+ * the signal thread, does not leave it behind.
+ */
+static void close_metrics(void)
+{
+    metrics_close(report_data->metrics_fd, report_data->opt.metrics_path);
+}
+
+/*
+ * Create a thread, or close the ncurses window and exit on failure: the 
+ * game cannot run without any of its threads.
+ */
+static void start_thread(
+        pthread_t *thread, 
+        void *(*routine)(void *), 
+        game_data *data, 
+        const char *name)
+{
+    int err = pthread_create(thread, NULL, routine, data);
+
+    if (err)
+    {
+        endwin();
+        restore_key_rate();
+        fprintf(stderr, "cannot create the %s thread: %s\n", name, 
+                strerror(err));
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "usage: %s [-a cpus] [-R] [-j] [-S] [-g half|braille] "
+            "[-s matches]\n"
+            "          [-d preset] [-P file] [-T file] [-b balls] [-c] [-B] "
+            "[-r seconds]\n"
+            "          [-M path] [-h]\n"
+            "  -a cpus  pin sim,input,render threads to cpus (e.g. 2,3,1)\n"
+            "  -R       request real-time scheduling and locked memory\n"
+            "  -j       print ball tick jitter distribution on exit\n"
+            "  -S       print per-thread accounting on exit\n"
+            "  -g mode  high resolution rendering, 2 rows per cell with\n"
+            "           half blocks or 4 with braille dots\n"
+            "  -s n     soak test: play n ai-vs-ai matches back to back and\n"
+            "           report memory, thread and fd usage on exit\n"
+            "  -d name  ai difficulty preset: classic, easy, medium, hard,\n"
+            "           expert, or one loaded with -P; in soak mode, the\n"
+            "           policy of the player paddle\n"
+            "  -P file  load ai presets from file\n"
+            "  -T file  tune the ai presets with self-play, save them to\n"
+            "           file and exit\n"
+            "  -b n     multi-ball mode: play with n balls, the match ends\n"
+            "           when the last one gets out\n"
+            "  -c       balls collide with each other in multi-ball mode\n"
+            "  -B       measure the multi-ball tick cost for growing ball\n"
+            "           counts and exit\n"
+            "  -r s     record the last s seconds of each match, 'r' rewinds\n"
+            "           by one second (not in multi-ball mode)\n"
+            "  -M path  serve Prometheus text (or JSON, if the request has\n"
+            "           'json') metrics on a Unix domain socket\n"
+            "  -h       show this help\n",
+            name);
+}
+
+int main(int argc, char **argv)
 {
     char buf[TAG_SIZE + 1]; /* buffer to take tags from the pipe in*/
     pthread_t keyboard_handler_thread; /* thread for keyboard handling */
     pthread_t ball_handler_thread; /* thread for ball position generation */
     pthread_t ai_handler_thread; /* thread for ai position handling */
     pthread_t signal_thread; /* thread for signal listening */
+    pthread_t metrics_thread; /* thread serving metrics */
     FILE *sett[2]; /* pipes to read xorg key settings */
-    game_data data; /* game data shared between threads */
+    static game_data data; /* game data shared between threads (static,
+                              * since print_reports runs after main) */
     sigset_t sigset; /* signal set */
+    int opt; /* command line option */
+    int i;
+    struct timespec overlay_time; /* last update of the stats overlay */
+    struct timespec now; /* current time */
+    const char *menu_msg = NULL; /* endgame message, NULL before first game */
+    long matches = 0; /* matches played to the end */
+    const char *preset = NULL; /* preset chosen from command line */
+
+    stats_init();
+    stats_thread_start(THREAD_MAIN);
+
+    /* parse command line */
+    for (i = 0; i < THREAD_ROLES; ++i)
+        data.opt.cpu[i] = -1;
+    data.opt.realtime = 0;
+    data.opt.jitter_report = 0;
+    data.opt.stats_summary = 0;
+    data.opt.vscale = 1;
+    data.opt.soak_matches = 0;
+    data.opt.balls = 0;
+    data.opt.ball_collisions = 0;
+    data.opt.rewind_seconds = 0;
+    data.opt.metrics_path = NULL;
+    data.stats_flag = 0;
+    while ((opt = getopt(argc, argv, "a:RjSg:s:d:P:T:b:cBr:M:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 'a':
+                if (rt_parse_cpus(&data.opt, optarg))
+                {
+                    fprintf(stderr, "%s: invalid cpu list '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'R':
+                data.opt.realtime = 1;
+                break;
+
+            case 'j':
+                data.opt.jitter_report = 1;
+                break;
+
+            case 'S':
+                data.opt.stats_summary = 1;
+                break;
+
+            case 'g':
+                if (!strcmp(optarg, "half"))
+                    data.opt.vscale = 2;
+                else if (!strcmp(optarg, "braille"))
+                    data.opt.vscale = 4;
+                else
+                {
+                    fprintf(stderr, "%s: unknown render mode '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 's':
+                data.opt.soak_matches = atol(optarg);
+                if (data.opt.soak_matches <= 0)
+                {
+                    fprintf(stderr, "%s: invalid match count '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'd':
+                preset = optarg;
+                break;
+
+            case 'P':
+                if (ai_load_presets(optarg))
+                {
+                    fprintf(stderr, "%s: cannot load presets from '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'T':
+                if (ai_tune(optarg))
+                {
+                    fprintf(stderr, "%s: cannot write presets to '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                exit(EXIT_SUCCESS);
+
+            case 'b':
+                data.opt.balls = atoi(optarg);
+                if (data.opt.balls <= 0)
+                {
+                    fprintf(stderr, "%s: invalid ball count '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'c':
+                data.opt.ball_collisions = 1;
+                break;
+
+            case 'B':
+                if (pool_bench(stdout))
+                {
+                    fprintf(stderr, "%s: out of memory\n", argv[0]);
+                    exit(EXIT_FAILURE);
+                }
+                exit(EXIT_SUCCESS);
+
+            case 'r':
+                data.opt.rewind_seconds = atoi(optarg);
+                if (data.opt.rewind_seconds <= 0)
+                {
+                    fprintf(stderr, "%s: invalid rewind span '%s'\n",
+                            argv[0], optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+
+            case 'M':
+                data.opt.metrics_path = optarg;
+                break;
+
+            case 'h':
+                usage(argv[0]);
+                exit(EXIT_SUCCESS);
+
+            default:
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+        }
+    }
+
+    /* the ai plays the chosen preset, or the classic tracker; in soak mode
+     * both paddles are imperfect so that matches come to an end, and the
+     * chosen preset drives the player paddle */
+    ai_find_preset(data.opt.soak_matches ? "soak" : "classic", &data.opt.ai);
+    ai_find_preset("soak", &data.opt.autopilot);
+    if (preset && ai_find_preset(preset, data.opt.soak_matches 
+                ? &data.opt.autopilot : &data.opt.ai))
+    {
+        fprintf(stderr, "%s: unknown ai preset '%s'\n", argv[0], preset);
+        exit(EXIT_FAILURE);
+    }
+
+    /* the rewind buffer records a single ball */
+    if (data.opt.balls && data.opt.rewind_seconds)
+    {
+        fprintf(stderr, "%s: rewind is not available in multi-ball mode\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    if (data.opt.balls 
+            && pool_init(&data.pool, data.opt.balls, data.opt.ball_collisions))
+    {
+        fprintf(stderr, "%s: out of memory\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    /* glyphs of the high resolution mode need a UTF-8 locale */
+    setlocale(LC_CTYPE, "");
+    if (data.opt.vscale > 1 && strcmp(nl_langinfo(CODESET), "UTF-8"))
+    {
+        fprintf(stderr, "%s: high resolution mode requires a UTF-8 locale\n",
+                argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    report_data = &data;
+    atexit(print_reports);
 
     srand(getpid());
 
@@ -99,13 +374,31 @@ int main(void)
     /* init game data */
     data.exit_flag = 0;
     data.play_flag = 0;
+    data.termination_flag = 1;
+    data.game = 0;
+    data.parked = 0;
+    data.tick_us = data.opt.soak_matches ? SOAK_TICK_US : TIME_GAP_BALL;
+    data.ai_tick_us = data.opt.soak_matches ? SOAK_TICK_US : TIME_GAP_AI;
     pthread_mutex_init(&data.mut, NULL);
+    pthread_mutex_init(&data.park_mut, NULL);
+    pthread_cond_init(&data.park_cond, NULL);
     if (pipe(data.pipedes) == -1)
     {
         perror("Pipe creation error\n");
         exit(EXIT_FAILURE);
     }
 
+    /* open the metrics socket, while errors can still be printed */
+    if (data.opt.metrics_path 
+            && (data.metrics_fd = metrics_open(data.opt.metrics_path)) == -1)
+    {
+        fprintf(stderr, "%s: cannot serve metrics on '%s': %s\n", argv[0],
+                data.opt.metrics_path, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    if (data.opt.metrics_path)
+        atexit(close_metrics);
+
     /* ncurses init */
     initscr();   /* init screen */
     noecho();    /* no keyboard echo on screen */
@@ -114,7 +407,7 @@ int main(void)
     timeout(0);  /* non-blocking input */
 
     /* get bottom row of the field */
-    data.bottom_row = getmaxy(stdscr) - 1; 
+    data.bottom_row = getmaxy(stdscr) * data.opt.vscale - 1; 
 
     /* check for color capability */
     if (has_colors() == FALSE)
@@ -136,79 +429,119 @@ int main(void)
     /* set color pair for ai */
     init_pair(AI_COLOR, COLOR_WHITE, COLOR_YELLOW);
 
+    /* set color pairs for paddles drawn with glyphs (high resolution) */
+    init_pair(PADDLE_HR_COLOR, COLOR_BLUE, COLOR_BLACK);
+    init_pair(AI_HR_COLOR, COLOR_YELLOW, COLOR_BLACK);
+    if (data.opt.vscale > 1)
+        bkgd(COLOR_PAIR(BALL_COLOR)); /* blank field, see blank_glyph */
+
     /* create thread for signal listening */
-    pthread_create(
-            &signal_thread,
-            NULL,
-            signal_listener,
-            &data);
+    start_thread(&signal_thread, signal_listener, &data, "signal");
+
+    /* create thread for metrics serving */
+    if (data.opt.metrics_path)
+        start_thread(&metrics_thread, metrics_server, &data, "metrics");
+
+    /* pin and schedule the main thread, once the helper threads are 
+     * created with the default policy */
+    rt_setup(&data.opt);
 
     print_intro_menu(stdscr);
 
+    /* create the worker threads, which live until the program exits */
+    start_thread(&keyboard_handler_thread, keyboard_handler, &data, 
+            "keyboard");
+    start_thread(&ai_handler_thread, ai_handler, &data, "ai");
+    start_thread(&ball_handler_thread, ball_handler, &data, "ball");
+
+    if (data.opt.soak_matches)
+        stats_soak_sample(0);
+
     /* each iteration is a single game */
-    do {
-        char c;
-        /* wait until the user press space (game start) or q (quit) */
-        do { 
-            c = getch();
-            if (c == QUIT_KEY)
-                /* safe because threads have not been created yet */
-                termination_handler(); 
-        } while (c != ' ');
-
-        /* play status on */
-        data.play_flag = 1;
-        data.termination_flag = 0; /* zero to run, non-zero to terminate */
+    while (!data.exit_flag)
+    {
+        /* wait until the user press space (game start) or q (quit); in 
+         * soak mode start the next match right away */
+        while (!data.opt.soak_matches && !data.exit_flag)
+        {
+            read(data.pipedes[0], buf, TAG_SIZE);
+            stats_wakeup(THREAD_MAIN);
+            if (!strcmp(buf, PLAY_TAG))
+                break;
+            if (atomic_exchange(&data.resize_pending, 0))
+            {
+                /* re-layout and print the menu centered again */
+                lock_game(&data);
+                resize_handler(&data);
+                clear();
+                if (menu_msg)
+                {
+                    draw_paddle(&data, AI_TAG);
+                    draw_paddle(&data, KBD_TAG);
+                    draw_ball(&data);
+                    print_intra_menu(stdscr, menu_msg);
+                    refresh();
+                }
+                else
+                    print_intro_menu(stdscr);
+                unlock_game(&data);
+            }
+        }
+        if (data.exit_flag || (data.opt.soak_matches 
+                    && matches == data.opt.soak_matches))
+            break;
+
+        /* workers must be parked before the game state is set up */
+        wait_workers_parked(&data);
+
+        /* set up the field (critical section, the keyboard thread is 
+         * reading keys) */
+        lock_game(&data);
 
         /* clear screen */
         clear();
 
-        /* init player paddle */
-        data.paddle_pos = (PADDLE_WIDTH / 2 
-                + data.bottom_row - PADDLE_WIDTH / 2) / 2;
+        /* init paddles and ball */
         data.paddle_col = getmaxx(stdscr) - 1;
-        draw_paddle(&data, KBD_TAG);
-
-        /* init ai paddle */
-        data.ai_paddle_pos = data.paddle_pos;
         data.ai_paddle_col = 1;
+        reset_field(&data, rand() % 2 == 0 ? 1 : -1);
+        if (data.opt.balls)
+        {
+            if (pool_layout(&data, LINES * COLS))
+            {
+                /* out of memory: quit without waking the workers */
+                data.exit_flag = 1;
+                unlock_game(&data);
+                break;
+            }
+            pool_reset(&data, rand());
+            data.pool.drawn = 0;
+        }
+        draw_paddle(&data, KBD_TAG);
         draw_paddle(&data, AI_TAG);
-
-        /* init ball */
-        data.ball_x_old = data.ball_x = data.paddle_col - 1;
-        data.ball_y_old = data.ball_y = data.paddle_pos;
-        data.ball_dirx = -1;
-        data.ball_diry = (rand() % 2 == 0 ? 1 : -1);
         draw_ball(&data);
 
-        /* create thread for keyboard handling */
-        pthread_create(
-                &keyboard_handler_thread,
-                NULL,
-                keyboard_handler,
-                &data);
-
-        /* create thread for ai */
-        pthread_create(
-                &ai_handler_thread,
-                NULL,
-                ai_handler,
-                &data);
-
-        /* create thread for ball movement */
-        pthread_create(
-                &ball_handler_thread,
-                NULL,
-                ball_handler,
-                &data);
+        unlock_game(&data);
+
+        /* draw the stats overlay, if enabled, on the first update */
+        overlay_time.tv_sec = overlay_time.tv_nsec = 0;
+        stats_frames_start(data.tick_us);
+
+        /* play status on, wake the workers */
+        start_game(&data);
 
         /* manage screen update */
         while (!data.exit_flag && data.play_flag)
         {
             read(data.pipedes[0], buf, TAG_SIZE);
+            stats_wakeup(THREAD_MAIN);
+            atomic_fetch_add_explicit(
+                    &stats.pipe_messages, 1, memory_order_relaxed);
 
             /* critical section */
-            pthread_mutex_lock(&data.mut);
+            lock_game(&data);
+            if (atomic_exchange(&data.resize_pending, 0))
+                resize_handler(&data); /* at most one re-layout per frame */
             if (!strcmp(buf, KBD_TAG)) /* data from keyboard */
             {
                 delete_paddle(&data, KBD_TAG);
@@ -223,33 +556,92 @@ int main(void)
             {
                 delete_ball(&data);
                 draw_ball(&data);
+                stats_frame();
+            }
+            if (!strcmp(buf, REWIND_TAG)) /* game rewound */
+            {
+                /* objects may have moved anywhere: redraw the field */
+                erase();
+                draw_paddle(&data, AI_TAG);
+                draw_paddle(&data, KBD_TAG);
+                draw_ball(&data);
+                overlay_time.tv_sec = overlay_time.tv_nsec = 0;
+            }
+            if (!strcmp(buf, STATS_TAG)) /* stats overlay toggle */
+            {
+                if (data.stats_flag)
+                    overlay_time.tv_sec = overlay_time.tv_nsec = 0;
+                else
+                {
+                    /* blank the overlay and restore what was under it */
+                    stats_erase(stdscr);
+                    draw_paddle(&data, AI_TAG);
+                    draw_paddle(&data, KBD_TAG);
+                    draw_ball(&data);
+                }
+            }
+            if (data.stats_flag)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                if (elapsed_us(&overlay_time, &now) >= STATS_INTERVAL * 1000)
+                {
+                    stats_draw(stdscr);
+                    overlay_time = now;
+                }
             }
-            refresh();
-            pthread_mutex_unlock(&data.mut);
+            /* ai moves are flushed with the next ball frame: the two 
+             * threads tick at the same rate, and each refresh costs the
+             * terminal an attribute reset */
+            if (strcmp(buf, AI_TAG))
+                refresh();
+            unlock_game(&data);
         }
 
-        /* allow termination of other threads */
+        /* allow parking of the other threads */
         data.termination_flag = 1; 
 
-        /* print endgame message in superimpression (critical section) */
-        if (!data.exit_flag)
+        if (data.exit_flag)
+            break;
+
+        matches++;
+        atomic_fetch_add_explicit(
+                data.winner ? &stats.matches_lost : &stats.matches_won,
+                1, memory_order_relaxed);
+
+        if (data.opt.soak_matches)
         {
-            pthread_mutex_lock(&data.mut);
-            print_intra_menu(
-                    stdscr,
-                    (data.winner ? "GAME LOST" : "GAME WON"));
-            pthread_mutex_unlock(&data.mut);
+            /* sample resource usage at regular intervals, rounded up so
+             * that there are at most SOAK_SAMPLES of them */
+            if (matches % ((data.opt.soak_matches + SOAK_SAMPLES - 1) 
+                        / SOAK_SAMPLES) == 0
+                    || matches == data.opt.soak_matches)
+                stats_soak_sample(matches);
+            continue;
         }
 
-    } while (!data.exit_flag);
+        /* print endgame message in superimpression (critical section) */
+        menu_msg = data.winner ? "GAME LOST" : "GAME WON";
+        lock_game(&data);
+        print_intra_menu(stdscr, menu_msg);
+        refresh();
+        unlock_game(&data);
+    }
 
-    /* wait for remaining children threads termination 
-     * (ball thread terminated itself yet) */
+    /* wait for children threads termination */
+    stop_workers(&data);
     pthread_join(ai_handler_thread, NULL);
+    pthread_join(ball_handler_thread, NULL);
     pthread_join(keyboard_handler_thread, NULL);
+    if (data.opt.metrics_path)
+    {
+        metrics_stop(data.metrics_fd);
+        pthread_join(metrics_thread, NULL); /* socket closed at exit */
+    }
 
     endwin(); /* close ncurses window */
 
+    pool_free(&data.pool);
+
     restore_key_rate(); /* restore keyboard settings */
 
     return 0;
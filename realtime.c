@@ -0,0 +1,246 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file realtime.c
+ * 
+ * \brief This file implements the low-jitter mode routines declared in 
+ * realtime.h.
+ */
+
+#include <sched.h>
+#include <sys/mman.h>
+#include <math.h>
+#include <stdatomic.h>
+#include "realtime.h"
+
+static int mem_locked = -1; /* -1 not requested, 0 failed, 1 locked */
+static atomic_int fifo_granted; /* threads running SCHED_FIFO */
+static atomic_int fifo_denied; /* threads which fell back to default */
+static atomic_int pin_denied; /* threads which could not be pinned */
+
+/*
+ * Distribution of the tick lateness.
+ */
+typedef struct {
+    long hist[JITTER_BUCKETS]; /* ticks per bucket */
+    long count; /* ticks recorded */
+    long min; /* min lateness */
+    long max; /* max lateness */
+    double sum; /* sum of the lateness */
+    double sumsq; /* sum of the squared lateness */
+} jitter_dist;
+
+/* tick jitter distributions, written by the ball thread only: the first 
+ * ticks under the default policy, if a baseline is taken, then the rest */
+static jitter_dist baseline;
+static jitter_dist jitter;
+static const game_options *sim_opt; /* options, for the deferred role */
+static int baseline_left; /* baseline ticks still to record */
+
+/* real-time priority for each role: simulation and input preempt drawing */
+static const int role_prio[THREAD_ROLES] = {2, 2, 1};
+static const char *role_name[THREAD_ROLES] = {"sim", "input", "render"};
+
+/*!
+ * Cpu numbers are validated against the cpu set size only; a cpu which is 
+ * offline is reported when the thread tries to pin itself.
+ */
+int rt_parse_cpus(game_options *opt, const char *list)
+{
+    int i;
+    int cpu = -1;
+    char *end;
+
+    for (i = 0; i < THREAD_ROLES; ++i)
+    {
+        if (*list)
+        {
+            cpu = strtol(list, &end, 10);
+            if (end == list || cpu < 0 || cpu >= CPU_SETSIZE
+                    || (*end != ',' && *end != '\0'))
+                return -1;
+            list = *end ? end + 1 : end;
+        }
+        opt->cpu[i] = cpu;
+    }
+
+    return *list ? -1 : 0;
+}
+
+/*!
+ * Memory is locked only once the main thread got SCHED_FIFO: without 
+ * real-time scheduling page faults are the least of the jitter sources,
+ * and locking all future allocations would only pin memory for nothing.
+ */
+void rt_setup(const game_options *opt)
+{
+    rt_thread(opt, ROLE_RENDER);
+
+    if (opt->realtime)
+        mem_locked = atomic_load(&fifo_granted) > 0
+            && mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+}
+
+/*!
+ * Pinning and scheduling are independent: a thread may be pinned while 
+ * SCHED_FIFO is denied (typically without CAP_SYS_NICE or RLIMIT_RTPRIO), 
+ * in which case it keeps running with the default policy. The policy is 
+ * reset on fork, so that commands run by the thread (xset) do not run 
+ * with real-time priority.
+ */
+void rt_thread(const game_options *opt, int role)
+{
+    if (opt->cpu[role] >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(opt->cpu[role], &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof set, &set))
+            atomic_fetch_add(&pin_denied, 1);
+    }
+
+    if (opt->realtime)
+    {
+        struct sched_param param;
+        param.sched_priority = 
+            sched_get_priority_min(SCHED_FIFO) + role_prio[role];
+        if (pthread_setschedparam(pthread_self(), 
+                    SCHED_FIFO | SCHED_RESET_ON_FORK, &param))
+            atomic_fetch_add(&fifo_denied, 1);
+        else
+            atomic_fetch_add(&fifo_granted, 1);
+    }
+}
+
+/*!
+ * A baseline is worth taking only when there is something to compare it 
+ * with, i.e. when pinning or real-time scheduling is requested along with
+ * the report.
+ */
+void jitter_start(const game_options *opt)
+{
+    if (opt->jitter_report && (opt->realtime || opt->cpu[ROLE_SIM] >= 0))
+    {
+        sim_opt = opt;
+        baseline_left = JITTER_BASELINE_TICKS;
+    }
+    else
+        rt_thread(opt, ROLE_SIM);
+}
+
+static void dist_record(jitter_dist *d, long late_us)
+{
+    long bucket = MAX(late_us, 0) / JITTER_BUCKET_US;
+
+    if (d->count == 0 || late_us < d->min)
+        d->min = late_us;
+    if (d->count == 0 || late_us > d->max)
+        d->max = late_us;
+
+    d->hist[MIN(bucket, JITTER_BUCKETS - 1)]++;
+    d->count++;
+    d->sum += late_us;
+    d->sumsq += (double) late_us * late_us;
+}
+
+void jitter_record(long late_us)
+{
+    if (baseline_left > 0)
+    {
+        dist_record(&baseline, late_us);
+        if (--baseline_left == 0)
+            rt_thread(sim_opt, ROLE_SIM); /* baseline done, apply the role */
+    }
+    else
+        dist_record(&jitter, late_us);
+}
+
+/*
+ * Return the upper bound in us of the bucket containing the given quantile.
+ */
+static long dist_quantile(const jitter_dist *d, double q)
+{
+    long i;
+    long seen = 0;
+    long rank = (long) ceil(q * d->count);
+
+    for (i = 0; i < JITTER_BUCKETS - 1; ++i)
+    {
+        seen += d->hist[i];
+        if (seen >= rank)
+            return (i + 1) * JITTER_BUCKET_US;
+    }
+
+    return d->max; /* overflow bucket */
+}
+
+/*
+ * Print a distribution, under the given title.
+ */
+static void dist_report(FILE *out, const jitter_dist *d, const char *title,
+        int tick_us)
+{
+    double mean;
+
+    if (d->count == 0)
+    {
+        fprintf(out, "%s: no ball ticks recorded\n", title);
+        return;
+    }
+
+    mean = d->sum / d->count;
+    fprintf(out,
+            "%s over %ld ticks (nominal %d us):\n"
+            "  mean %.1f us  stddev %.1f us  min %ld us  max %ld us\n"
+            "  p50 <%ld us  p90 <%ld us  p99 <%ld us  p99.9 <%ld us\n",
+            title, d->count, tick_us,
+            mean, sqrt(MAX(d->sumsq / d->count - mean * mean, 0)),
+            d->min, d->max,
+            dist_quantile(d, 0.5), dist_quantile(d, 0.9),
+            dist_quantile(d, 0.99), dist_quantile(d, 0.999));
+}
+
+void jitter_report(FILE *out, const game_options *opt, int tick_us)
+{
+    int i;
+
+    fprintf(out, "scheduling: ");
+    if (atomic_load(&fifo_granted) && !atomic_load(&fifo_denied))
+        fprintf(out, "SCHED_FIFO");
+    else if (atomic_load(&fifo_granted))
+        fprintf(out, "SCHED_FIFO for %d threads, default for %d",
+                atomic_load(&fifo_granted), atomic_load(&fifo_denied));
+    else if (atomic_load(&fifo_denied))
+        fprintf(out, "default (SCHED_FIFO not permitted)");
+    else
+        fprintf(out, "default");
+    if (mem_locked >= 0)
+        fprintf(out, ", memory %s", mem_locked ? "locked" : "not locked");
+    for (i = 0; i < THREAD_ROLES; ++i)
+        if (opt->cpu[i] >= 0)
+            fprintf(out, ", %s on cpu %d", role_name[i], opt->cpu[i]);
+    if (atomic_load(&pin_denied))
+        fprintf(out, " (%d threads could not be pinned)",
+                atomic_load(&pin_denied));
+    fprintf(out, "\n");
+
+    if (sim_opt)
+        dist_report(out, &baseline, 
+                "tick jitter, default scheduling (baseline)", tick_us);
+    dist_report(out, &jitter, "tick jitter", tick_us);
+}
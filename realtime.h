@@ -0,0 +1,98 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file realtime.h
+ * 
+ * \brief This file declares routines for the low-jitter mode: cpu 
+ * pinning and real-time scheduling of the game threads, and measurement of
+ * the ball tick jitter.
+ */
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#include "support.h"
+
+#define JITTER_BUCKET_US 10 /*!< width in us of a jitter histogram bucket */
+#define JITTER_BUCKETS 1000 /*!< number of buckets (last one is overflow) */
+#define JITTER_BASELINE_TICKS 400 /*!< ticks measured before the sim role */
+
+/*!
+ * \brief Parse a comma separated cpu list for the thread roles.
+ *
+ * The list gives the cpu for the simulation, input and render threads, in
+ * this order. Missing entries repeat the last cpu given.
+ *
+ * @param opt options to fill
+ * @param list cpu list, e.g. "2,3,1"
+ * @return 0 on success, -1 on malformed list
+ */
+int rt_parse_cpus(game_options *opt, const char *list);
+
+/*!
+ * \brief Set up the process for the selected scheduling mode.
+ *
+ * Apply the render role to the calling (main) thread and, when real-time
+ * scheduling was requested and granted, lock memory. Must be called after
+ * the helper threads (signal listener, metrics server) are created, so 
+ * they keep the default policy and cpus, and before the game threads, 
+ * which apply their own role.
+ *
+ * @param opt command line options
+ */
+void rt_setup(const game_options *opt);
+
+/*!
+ * \brief Apply cpu pinning and scheduling policy of a role to the calling 
+ * thread. Failures are recorded and scheduling falls back to the default.
+ *
+ * @param opt command line options
+ * @param role thread role (ROLE_SIM, ROLE_INPUT or ROLE_RENDER)
+ */
+void rt_thread(const game_options *opt, int role);
+
+/*!
+ * \brief Start the jitter measurement on the calling (ball) thread.
+ *
+ * When the report is requested along with pinning or real-time 
+ * scheduling, the first JITTER_BASELINE_TICKS ticks are recorded as a 
+ * baseline under the default policy, and the simulation role is applied
+ * to the thread afterwards; otherwise the role is applied at once.
+ *
+ * @param opt command line options, which must outlive the thread
+ */
+void jitter_start(const game_options *opt);
+
+/*!
+ * \brief Record the lateness of a ball tick.
+ *
+ * @param late_us difference in us between the measured and nominal tick
+ */
+void jitter_record(long late_us);
+
+/*!
+ * \brief Print the tick jitter distribution and the scheduling mode that
+ * was actually obtained, after the baseline distribution if one was taken.
+ *
+ * @param out output stream
+ * @param opt command line options
+ * @param tick_us nominal time in us between ball ticks
+ */
+void jitter_report(FILE *out, const game_options *opt, int tick_us);
+
+#endif /* REALTIME_H */
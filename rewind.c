@@ -0,0 +1,242 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file rewind.c
+ * 
+ * \brief This file implements the rewind buffer declared in rewind.h.
+ */
+
+#include "rewind.h"
+
+#define KEY_FLAG 0x80 /* record mask bit of a keyframe */
+#define ALL_FIELDS ((1 << REWIND_FIELDS) - 1) /* record mask of all fields */
+
+/*
+ * Copy the simulation fields out of game_data.
+ */
+static void get_fields(const game_data *data, int *v)
+{
+    v[0] = data->paddle_pos;
+    v[1] = data->ai_paddle_pos;
+    v[2] = data->ball_x;
+    v[3] = data->ball_y;
+    v[4] = data->ball_dirx;
+    v[5] = data->ball_diry;
+}
+
+/*
+ * Copy the simulation fields into game_data.
+ */
+static void set_fields(game_data *data, const int *v)
+{
+    data->paddle_pos = v[0];
+    data->ai_paddle_pos = v[1];
+    data->ball_x = v[2];
+    data->ball_y = v[3];
+    data->ball_dirx = v[4];
+    data->ball_diry = v[5];
+}
+
+/*
+ * Write a value as a zigzag varint, so that small negative deltas take a
+ * byte as the positive ones. Return the bytes written.
+ */
+static int put_varint(unsigned char *p, int v)
+{
+    unsigned int z = ((unsigned int) v << 1) ^ (v < 0 ? ~0u : 0u);
+    int n = 0;
+
+    while (z >= 0x80)
+    {
+        p[n++] = (z & 0x7f) | 0x80;
+        z >>= 7;
+    }
+    p[n++] = z;
+
+    return n;
+}
+
+/*
+ * Read a zigzag varint at an offset of the ring, advancing the offset.
+ */
+static int get_varint(const rewind_buffer *rb, unsigned long *off)
+{
+    unsigned int z = 0;
+    unsigned char c;
+    int shift = 0;
+
+    do
+    {
+        c = rb->buf[(*off)++ & (rb->size - 1)];
+        z |= (unsigned int) (c & 0x7f) << shift;
+        shift += 7;
+    } while (c & 0x80);
+
+    return (int) (z >> 1) ^ -(int) (z & 1);
+}
+
+/*
+ * Decode the record at an offset of the ring, advancing the offset. A 
+ * delta record is applied to the fields of its keyframe.
+ */
+static void read_record(const rewind_buffer *rb, unsigned long *off, 
+        const int *key, int *v)
+{
+    int mask = rb->buf[(*off)++ & (rb->size - 1)];
+    int i;
+
+    for (i = 0; i < REWIND_FIELDS; ++i)
+        if (mask & KEY_FLAG)
+            v[i] = get_varint(rb, off);
+        else
+            v[i] = key[i] + (mask & (1 << i) ? get_varint(rb, off) : 0);
+}
+
+/*
+ * Drop the oldest keyframe with its deltas.
+ */
+static void evict(rewind_buffer *rb)
+{
+    rb->key_first = (rb->key_first + 1) % rb->key_size;
+    rb->key_count--;
+    rb->first_tick += REWIND_KEYFRAME;
+    rb->tail = rb->key_count ? rb->key_off[rb->key_first] : rb->head;
+}
+
+/*!
+ * The ring is sized on REWIND_AVG_BYTES per tick, but always holds two 
+ * keyframes with all their deltas at the largest size, so that the 
+ * keyframe of the record being written is never evicted.
+ */
+int rewind_init(rewind_buffer *rb, int seconds, int tick_us)
+{
+    long ticks = (long) seconds * 1000000 / tick_us + 1;
+    unsigned long want = MAX(ticks * REWIND_AVG_BYTES, 
+            2 * REWIND_KEYFRAME * REWIND_RECORD_MAX);
+
+    memset(rb, 0, sizeof *rb);
+    for (rb->size = 1; rb->size < want; rb->size <<= 1)
+        ;
+    rb->key_size = ticks / REWIND_KEYFRAME + 2;
+    rb->buf = malloc(rb->size);
+    rb->key_off = malloc(rb->key_size * sizeof *rb->key_off);
+
+    if (!rb->buf || !rb->key_off)
+    {
+        rewind_free(rb);
+        return -1;
+    }
+
+    return 0;
+}
+
+void rewind_free(rewind_buffer *rb)
+{
+    free(rb->buf);
+    free(rb->key_off);
+    memset(rb, 0, sizeof *rb);
+}
+
+void rewind_clear(rewind_buffer *rb)
+{
+    rb->head = rb->tail = 0;
+    rb->key_first = rb->key_count = 0;
+    rb->first_tick = rb->ticks = 0;
+}
+
+int rewind_record(rewind_buffer *rb, const game_data *data)
+{
+    unsigned char rec[REWIND_RECORD_MAX]; /* the record being written */
+    int v[REWIND_FIELDS];
+    int len = 1;
+    int mask = 0;
+    int i;
+
+    get_fields(data, v);
+
+    if (rb->ticks % REWIND_KEYFRAME == 0)
+    {
+        /* keyframe: all the fields, starting a new group */
+        mask = KEY_FLAG | ALL_FIELDS;
+        for (i = 0; i < REWIND_FIELDS; ++i)
+        {
+            len += put_varint(rec + len, v[i]);
+            rb->key[i] = v[i];
+        }
+        if (rb->key_count == rb->key_size)
+            evict(rb); /* older than the span */
+        rb->key_off[(rb->key_first + rb->key_count++) % rb->key_size] = 
+            rb->head;
+    } else {
+        /* delta: the fields which differ from the keyframe */
+        for (i = 0; i < REWIND_FIELDS; ++i)
+            if (v[i] != rb->key[i])
+            {
+                mask |= 1 << i;
+                len += put_varint(rec + len, v[i] - rb->key[i]);
+            }
+    }
+    rec[0] = mask;
+
+    /* make room, keeping the group of this record */
+    while (rb->head + len - rb->tail > rb->size && rb->key_count > 1)
+        evict(rb);
+
+    for (i = 0; i < len; ++i)
+        rb->buf[(rb->head + i) & (rb->size - 1)] = rec[i];
+    rb->head += len;
+    rb->ticks++;
+
+    return len;
+}
+
+/*!
+ * Restoring decodes the keyframe of the tick and at most 
+ * REWIND_KEYFRAME - 1 deltas.
+ */
+long rewind_restore(rewind_buffer *rb, game_data *data, long ticks)
+{
+    int key[REWIND_FIELDS]; /* fields of the keyframe */
+    int v[REWIND_FIELDS]; /* fields of the tick restored */
+    unsigned long off; /* offset of the next record */
+    long last = rb->ticks - 1; /* latest tick recorded */
+    long target; /* tick restored */
+    long t;
+    int g; /* group of the tick restored */
+
+    if (!rb->key_count)
+        return 0;
+
+    target = MAX(last - ticks, rb->first_tick);
+    g = (target - rb->first_tick) / REWIND_KEYFRAME;
+    off = rb->key_off[(rb->key_first + g) % rb->key_size];
+
+    read_record(rb, &off, NULL, key);
+    memcpy(v, key, sizeof v);
+    for (t = rb->first_tick + (long) g * REWIND_KEYFRAME; t < target; ++t)
+        read_record(rb, &off, key, v);
+    set_fields(data, v);
+
+    /* drop the records after the target */
+    memcpy(rb->key, key, sizeof key);
+    rb->head = off;
+    rb->ticks = target + 1;
+    rb->key_count = g + 1;
+
+    return last - target;
+}
@@ -0,0 +1,103 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file rewind.h
+ * 
+ * \brief This file declares the rewind buffer, which records the state of
+ * the simulation at each tick of the last seconds of a game.
+ *
+ * Every REWIND_KEYFRAME ticks a keyframe stores the simulation fields of 
+ * game_data; the other ticks store the fields which differ from their 
+ * keyframe, as zigzag varint deltas after a bitmask. Records are packed 
+ * in a ring of bytes, and the oldest keyframe is evicted with its deltas
+ * when the ring is full or older than the requested span.
+ */
+
+#ifndef REWIND_H
+#define REWIND_H
+
+#include "support.h"
+
+#define REWIND_KEYFRAME 64 /*!< ticks between keyframes */
+#define REWIND_FIELDS 6 /*!< simulation fields recorded */
+#define REWIND_RECORD_MAX (1 + REWIND_FIELDS * 5) /*!< max record bytes */
+#define REWIND_AVG_BYTES 8 /*!< record bytes per tick the ring is sized on */
+#define REWIND_STEP_S 1 /*!< seconds rewound by a key press */
+
+/*!
+ * Ring of tick records
+ */
+typedef struct {
+    unsigned char *buf; /*!< bytes of the records */
+    unsigned long size; /*!< size of buf, a power of 2 */
+    unsigned long head; /*!< offset of the next record */
+    unsigned long tail; /*!< offset of the oldest record */
+    unsigned long *key_off; /*!< offsets of the keyframes, from the oldest */
+    int key_size; /*!< size of key_off */
+    int key_first; /*!< slot of the oldest keyframe in key_off */
+    int key_count; /*!< keyframes in the ring */
+    long first_tick; /*!< tick of the oldest keyframe */
+    long ticks; /*!< ticks recorded since the game start */
+    int key[REWIND_FIELDS]; /*!< fields of the latest keyframe */
+} rewind_buffer;
+
+/*!
+ * \brief Allocate a rewind buffer.
+ *
+ * @param rb rewind buffer
+ * @param seconds span of the buffer
+ * @param tick_us time in us between ticks
+ * @return 0 on success, -1 if memory is exhausted
+ */
+int rewind_init(rewind_buffer *rb, int seconds, int tick_us);
+
+/*!
+ * \brief Free the memory of a rewind buffer.
+ *
+ * @param rb rewind buffer
+ */
+void rewind_free(rewind_buffer *rb);
+
+/*!
+ * \brief Drop all the records, for a new game.
+ *
+ * @param rb rewind buffer
+ */
+void rewind_clear(rewind_buffer *rb);
+
+/*!
+ * \brief Record the simulation fields of the current tick.
+ *
+ * @param rb rewind buffer
+ * @param data game_data structure
+ * @return bytes taken by the record
+ */
+int rewind_record(rewind_buffer *rb, const game_data *data);
+
+/*!
+ * \brief Restore the simulation fields as they were some ticks ago, and 
+ * drop the records after that tick, so that the game continues from it.
+ *
+ * @param rb rewind buffer
+ * @param data game_data structure
+ * @param ticks ticks to go back, limited to the oldest record
+ * @return ticks gone back
+ */
+long rewind_restore(rewind_buffer *rb, game_data *data, long ticks);
+
+#endif /* REWIND_H */
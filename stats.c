@@ -0,0 +1,511 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file stats.c
+ * 
+ * \brief This file implements the accounting routines declared in stats.h.
+ */
+
+#include <sys/resource.h>
+#include <dirent.h>
+#include "stats.h"
+
+#define STATS_WIDTH 56 /* width of the overlay */
+#define STATS_LINE_SIZE 128 /* size of a formatted line, not clipped */
+#define STATS_LINES (STATS_THREADS + 6) /* header, threads, counters */
+
+game_stats stats;
+
+/*
+ * Cumulative figures of a slot at a given instant.
+ */
+typedef struct {
+    long cpu_ns; /* cpu time */
+    long vcsw; /* voluntary context switches */
+    long ivcsw; /* involuntary context switches */
+    long wakeups; /* wake ups */
+} thread_sample;
+
+/*
+ * Snapshot of all the counters at a given instant.
+ */
+typedef struct {
+    struct timespec when; /* instant of the snapshot */
+    thread_sample thread[STATS_THREADS]; /* per-thread figures */
+    long lock_count; /* acquisitions of data.mut */
+    long lock_contended; /* contended acquisitions of data.mut */
+    long pipe_messages; /* messages read by the controller */
+    long resize_events; /* SIGWINCH received */
+    long relayouts; /* field re-layouts */
+    long frames; /* ball frames drawn */
+    long frames_dropped; /* ball frames drawn late */
+    long terminal_bytes; /* bytes written by the main thread */
+    long steps; /* ball ticks stepped */
+    long step_ns; /* time spent stepping the balls */
+    long step_balls; /* balls stepped over the ticks */
+    int balls; /* balls stepped in the last tick */
+    long snapshots; /* ticks recorded for rewind */
+    long snapshot_ns; /* time spent recording ticks */
+    long snapshot_bytes; /* bytes of the tick records */
+    long restores; /* rewinds */
+    long restore_ns; /* time spent restoring ticks */
+} stats_sample;
+
+static const char *thread_name[STATS_THREADS] = {
+    "main", "keyboard", "ai", "ball", "signal", "metrics"
+};
+
+static stats_sample overlay_prev; /* sample of the last overlay update */
+static struct timespec last_frame; /* instant of the last ball frame */
+static int frame_tick_us; /* time in us between ball frames */
+
+/*
+ * Resource usage of the process after a number of soak matches.
+ */
+typedef struct {
+    long match; /* matches played */
+    struct timespec when; /* instant of the sample */
+    long rss_kb; /* resident memory */
+    long threads; /* thread count */
+    long fds; /* open file descriptors */
+} soak_sample;
+
+static soak_sample soak[SOAK_SAMPLES + 2]; /* start, samples and end */
+static int soak_count; /* samples taken */
+
+void stats_init(void)
+{
+    pthread_mutex_init(&stats.mut, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &stats.start);
+    overlay_prev.when = stats.start;
+}
+
+void stats_thread_start(int slot)
+{
+    thread_stats *t = &stats.thread[slot];
+
+    pthread_mutex_lock(&stats.mut);
+    t->tid = gettid();
+    pthread_getcpuclockid(pthread_self(), &t->clock);
+    pthread_mutex_unlock(&stats.mut);
+}
+
+/*!
+ * Context switches of a terminated thread are no longer visible in /proc, 
+ * so the thread reads its own rusage before leaving.
+ */
+void stats_thread_stop(int slot)
+{
+    thread_stats *t = &stats.thread[slot];
+    struct rusage ru;
+    struct timespec cpu;
+
+    getrusage(RUSAGE_THREAD, &ru);
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+
+    pthread_mutex_lock(&stats.mut);
+    t->cpu_ns_done += cpu.tv_sec * 1000000000L + cpu.tv_nsec;
+    t->vcsw_done += ru.ru_nvcsw;
+    t->ivcsw_done += ru.ru_nivcsw;
+    t->tid = 0;
+    pthread_mutex_unlock(&stats.mut);
+}
+
+void stats_wakeup(int slot)
+{
+    atomic_fetch_add_explicit(
+            &stats.thread[slot].wakeups, 1, memory_order_relaxed);
+}
+
+void stats_frames_start(int tick_us)
+{
+    last_frame.tv_sec = last_frame.tv_nsec = 0;
+    frame_tick_us = tick_us;
+}
+
+void stats_frame(void)
+{
+    struct timespec now;
+    long late;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = elapsed_us(&last_frame, &now) / frame_tick_us - 1;
+
+    atomic_fetch_add_explicit(&stats.frames, 1, memory_order_relaxed);
+    if (last_frame.tv_sec && late >= 1)
+        atomic_fetch_add_explicit(
+                &stats.frames_dropped, late, memory_order_relaxed);
+
+    last_frame = now;
+}
+
+/*!
+ * The max is kept with a compare and swap loop, which rarely runs more 
+ * than once: the max grows seldom.
+ */
+void stats_tick(long late_us)
+{
+    long max = atomic_load_explicit(
+            &stats.tick_late_max_us, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&stats.ticks, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(
+            &stats.tick_late_us, MAX(late_us, 0), memory_order_relaxed);
+    while (late_us > max && !atomic_compare_exchange_weak_explicit(
+                &stats.tick_late_max_us, &max, late_us, 
+                memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+void stats_step(long ns, int balls)
+{
+    atomic_fetch_add_explicit(&stats.steps, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.step_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.step_balls, balls, memory_order_relaxed);
+    atomic_store_explicit(&stats.balls, balls, memory_order_relaxed);
+}
+
+void stats_snapshot(long ns, int bytes)
+{
+    atomic_fetch_add_explicit(&stats.snapshots, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.snapshot_ns, ns, memory_order_relaxed);
+    atomic_fetch_add_explicit(
+            &stats.snapshot_bytes, bytes, memory_order_relaxed);
+}
+
+void stats_restore(long ns)
+{
+    atomic_fetch_add_explicit(&stats.restores, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&stats.restore_ns, ns, memory_order_relaxed);
+}
+
+/*
+ * Add the context switches of a running thread, read from /proc.
+ */
+static void add_ctxt_switches(pid_t tid, thread_sample *s)
+{
+    char path[64];
+    char line[128];
+    long n;
+    FILE *f;
+
+    snprintf(path, sizeof path, "/proc/self/task/%d/status", (int) tid);
+    if (!(f = fopen(path, "r")))
+        return;
+    while (fgets(line, sizeof line, f))
+    {
+        if (sscanf(line, "voluntary_ctxt_switches: %ld", &n) == 1)
+            s->vcsw += n;
+        else if (sscanf(line, "nonvoluntary_ctxt_switches: %ld", &n) == 1)
+            s->ivcsw += n;
+    }
+    fclose(f);
+}
+
+/*
+ * Return the bytes written so far by a thread. All the drawing is done by 
+ * the main thread, so its count is the output sent to the terminal; the 
+ * bytes never pass through a stream the program owns, since ncurses 
+ * writes to the terminal by itself.
+ */
+static long written_bytes(pid_t tid)
+{
+    char path[64];
+    char line[128];
+    long n = 0;
+    FILE *f;
+
+    snprintf(path, sizeof path, "/proc/self/task/%d/io", (int) tid);
+    if (!(f = fopen(path, "r")))
+        return 0;
+    while (fgets(line, sizeof line, f))
+        if (sscanf(line, "wchar: %ld", &n) == 1)
+            break;
+    fclose(f);
+
+    return n;
+}
+
+long stats_terminal_bytes(void)
+{
+    long n;
+
+    pthread_mutex_lock(&stats.mut);
+    n = written_bytes(stats.thread[THREAD_MAIN].tid);
+    pthread_mutex_unlock(&stats.mut);
+
+    return n;
+}
+
+static void take_sample(stats_sample *s)
+{
+    int i;
+    struct timespec cpu;
+
+    clock_gettime(CLOCK_MONOTONIC, &s->when);
+
+    pthread_mutex_lock(&stats.mut);
+    for (i = 0; i < STATS_THREADS; ++i)
+    {
+        thread_stats *t = &stats.thread[i];
+        thread_sample *ts = &s->thread[i];
+
+        ts->cpu_ns = t->cpu_ns_done;
+        ts->vcsw = t->vcsw_done;
+        ts->ivcsw = t->ivcsw_done;
+        ts->wakeups = atomic_load_explicit(
+                &t->wakeups, memory_order_relaxed);
+        if (t->tid)
+        {
+            if (clock_gettime(t->clock, &cpu) == 0)
+                ts->cpu_ns += cpu.tv_sec * 1000000000L + cpu.tv_nsec;
+            add_ctxt_switches(t->tid, ts);
+        }
+    }
+    s->terminal_bytes = written_bytes(stats.thread[THREAD_MAIN].tid);
+    pthread_mutex_unlock(&stats.mut);
+
+    s->lock_count = atomic_load_explicit(
+            &stats.lock_count, memory_order_relaxed);
+    s->lock_contended = atomic_load_explicit(
+            &stats.lock_contended, memory_order_relaxed);
+    s->pipe_messages = atomic_load_explicit(
+            &stats.pipe_messages, memory_order_relaxed);
+    s->resize_events = atomic_load_explicit(
+            &stats.resize_events, memory_order_relaxed);
+    s->relayouts = atomic_load_explicit(
+            &stats.relayouts, memory_order_relaxed);
+    s->frames = atomic_load_explicit(&stats.frames, memory_order_relaxed);
+    s->frames_dropped = atomic_load_explicit(
+            &stats.frames_dropped, memory_order_relaxed);
+    s->steps = atomic_load_explicit(&stats.steps, memory_order_relaxed);
+    s->step_ns = atomic_load_explicit(&stats.step_ns, memory_order_relaxed);
+    s->step_balls = atomic_load_explicit(
+            &stats.step_balls, memory_order_relaxed);
+    s->balls = atomic_load_explicit(&stats.balls, memory_order_relaxed);
+    s->snapshots = atomic_load_explicit(
+            &stats.snapshots, memory_order_relaxed);
+    s->snapshot_ns = atomic_load_explicit(
+            &stats.snapshot_ns, memory_order_relaxed);
+    s->snapshot_bytes = atomic_load_explicit(
+            &stats.snapshot_bytes, memory_order_relaxed);
+    s->restores = atomic_load_explicit(&stats.restores, memory_order_relaxed);
+    s->restore_ns = atomic_load_explicit(
+            &stats.restore_ns, memory_order_relaxed);
+}
+
+/*
+ * Format the figures accumulated between two samples. Cpu time and 
+ * switches are totals over the interval, the others are per second rates.
+ * Lines are not clipped to the overlay: totals of a long run are wider.
+ */
+static void format_lines(
+        char lines[STATS_LINES][STATS_LINE_SIZE],
+        const stats_sample *from,
+        const stats_sample *to)
+{
+    int i;
+    long locks = to->lock_count - from->lock_count;
+    long contended = to->lock_contended - from->lock_contended;
+    double dt = MAX(elapsed_us(&from->when, &to->when), 1) / 1e6;
+
+    snprintf(lines[0], STATS_LINE_SIZE, "%-8s %9s %6s %7s %7s %8s",
+            "thread", "cpu ms", "cpu%", "vcsw", "ivcsw", "wake/s");
+    for (i = 0; i < STATS_THREADS; ++i)
+    {
+        const thread_sample *a = &from->thread[i];
+        const thread_sample *b = &to->thread[i];
+        double cpu_ms = (b->cpu_ns - a->cpu_ns) / 1e6;
+
+        snprintf(lines[i + 1], STATS_LINE_SIZE,
+                "%-8s %9.1f %6.1f %7ld %7ld %8.1f",
+                thread_name[i], cpu_ms, cpu_ms / (10 * dt),
+                b->vcsw - a->vcsw, b->ivcsw - a->ivcsw,
+                (b->wakeups - a->wakeups) / dt);
+    }
+    snprintf(lines[STATS_LINES - 5], STATS_LINE_SIZE,
+            "physics %d balls %.2f us/tick %.1f ns/ball",
+            to->balls, 
+            (to->step_ns - from->step_ns) / 1e3 
+                / MAX(to->steps - from->steps, 1),
+            (double) (to->step_ns - from->step_ns) 
+                / MAX(to->step_balls - from->step_balls, 1));
+    /* rewinds are rare, their cost is averaged over the whole run */
+    snprintf(lines[STATS_LINES - 4], STATS_LINE_SIZE,
+            "rewind %.2f us/snap %.2f us/restore %.1f KiB/min",
+            (to->snapshot_ns - from->snapshot_ns) / 1e3 
+                / MAX(to->snapshots - from->snapshots, 1),
+            to->restore_ns / 1e3 / MAX(to->restores, 1),
+            (to->snapshot_bytes - from->snapshot_bytes) / 1024.0 
+                / dt * 60);
+    snprintf(lines[STATS_LINES - 3], STATS_LINE_SIZE,
+            "mutex %ld locks %ld contended (%.1f%%) pipe %.1f msg/s",
+            locks, contended, 100.0 * contended / MAX(locks, 1),
+            (to->pipe_messages - from->pipe_messages) / dt);
+    snprintf(lines[STATS_LINES - 2], STATS_LINE_SIZE,
+            "resize %ld events %ld layouts",
+            to->resize_events - from->resize_events,
+            to->relayouts - from->relayouts);
+    snprintf(lines[STATS_LINES - 1], STATS_LINE_SIZE,
+            "frames %ld dropped %ld terminal %.0f bytes/frame",
+            to->frames - from->frames,
+            to->frames_dropped - from->frames_dropped,
+            (double) (to->terminal_bytes - from->terminal_bytes)
+                / MAX(to->frames - from->frames, 1));
+}
+
+/*
+ * Width of the overlay in the window, which ends before the last column,
+ * where the player paddle is drawn.
+ */
+static int overlay_width(WINDOW *win)
+{
+    return MAX(MIN(STATS_WIDTH, getmaxx(win) - STATS_COL - 1), 0);
+}
+
+void stats_draw(WINDOW *win)
+{
+    int i;
+    stats_sample now;
+    char lines[STATS_LINES][STATS_LINE_SIZE];
+
+    take_sample(&now);
+    format_lines(lines, &overlay_prev, &now);
+    overlay_prev = now;
+
+    /* clip on the right instead of wrapping on small windows */
+    wattron(win, COLOR_PAIR(TITLE_COLOR));
+    for (i = 0; i < STATS_LINES; ++i)
+    {
+        int n = MIN((int) strlen(lines[i]), overlay_width(win));
+        mvwhline(win, STATS_ROW + i, STATS_COL, ' ', overlay_width(win));
+        mvwaddnstr(win, STATS_ROW + i, STATS_COL, lines[i], n);
+    }
+    wattroff(win, COLOR_PAIR(TITLE_COLOR));
+}
+
+void stats_erase(WINDOW *win)
+{
+    int i;
+
+    for (i = 0; i < STATS_LINES; ++i)
+        mvwhline(win, STATS_ROW + i, STATS_COL, ' ', overlay_width(win));
+}
+
+void stats_summary(FILE *out)
+{
+    int i;
+    stats_sample start, now;
+    char lines[STATS_LINES][STATS_LINE_SIZE];
+
+    memset(&start, 0, sizeof start);
+    start.when = stats.start;
+    take_sample(&now);
+    format_lines(lines, &start, &now);
+
+    fprintf(out, "thread accounting over %.1f s:\n", 
+            elapsed_us(&start.when, &now.when) / 1e6);
+    for (i = 0; i < STATS_LINES; ++i)
+        fprintf(out, "  %s\n", lines[i]);
+}
+
+/*!
+ * The caller samples at most SOAK_SAMPLES times after the start, plus the
+ * end of the test. Should the buffer be full anyway, the last sample is 
+ * replaced, so that the end of the test is always recorded.
+ */
+void stats_soak_sample(long match)
+{
+    soak_sample *s;
+    char line[128];
+    long pages;
+    FILE *f;
+    DIR *dir;
+
+    if (soak_count == SOAK_SAMPLES + 2)
+        soak_count--;
+    s = &soak[soak_count];
+
+    s->match = match;
+    s->rss_kb = s->threads = s->fds = 0;
+    clock_gettime(CLOCK_MONOTONIC, &s->when);
+
+    if ((f = fopen("/proc/self/statm", "r")))
+    {
+        if (fscanf(f, "%*s %ld", &pages) == 1)
+            s->rss_kb = pages * (sysconf(_SC_PAGESIZE) / 1024);
+        fclose(f);
+    }
+
+    if ((f = fopen("/proc/self/status", "r")))
+    {
+        while (fgets(line, sizeof line, f))
+            if (sscanf(line, "Threads: %ld", &s->threads) == 1)
+                break;
+        fclose(f);
+    }
+
+    /* the directory stream holds a descriptor of its own */
+    if ((dir = opendir("/proc/self/fd")))
+    {
+        while (readdir(dir))
+            s->fds++;
+        s->fds -= 3; /* ".", ".." and the stream */
+        closedir(dir);
+    }
+
+    soak_count++;
+}
+
+/*!
+ * The drift is measured from the sample after the first match, so the 
+ * memory ncurses allocates when drawing the first game is not counted.
+ */
+void stats_soak_report(FILE *out)
+{
+    int i;
+    const soak_sample *first;
+    const soak_sample *last;
+    double secs;
+
+    if (soak_count < 2)
+    {
+        fprintf(out, "soak: no match completed\n");
+        return;
+    }
+
+    first = &soak[soak_count > 2 ? 1 : 0];
+    last = &soak[soak_count - 1];
+    secs = elapsed_us(&soak[0].when, &last->when) / 1e6;
+
+    fprintf(out, "soak: %ld matches in %.1f s (%.1f matches/s), "
+            "player won %ld, ai won %ld\n",
+            last->match, secs, last->match / MAX(secs, 1e-6),
+            atomic_load(&stats.matches_won),
+            atomic_load(&stats.matches_lost));
+    fprintf(out, "  %8s %9s %9s %8s %6s\n",
+            "match", "time s", "rss KiB", "threads", "fds");
+    for (i = 0; i < soak_count; ++i)
+        fprintf(out, "  %8ld %9.1f %9ld %8ld %6ld\n",
+                soak[i].match, elapsed_us(&soak[0].when, &soak[i].when) / 1e6,
+                soak[i].rss_kb, soak[i].threads, soak[i].fds);
+    fprintf(out, "drift after match %ld: rss %+ld KiB, threads %+ld, "
+            "fds %+ld\n",
+            first->match, last->rss_kb - first->rss_kb,
+            last->threads - first->threads, last->fds - first->fds);
+}
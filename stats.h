@@ -0,0 +1,208 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file stats.h
+ * 
+ * \brief This file declares the per-thread accounting (cpu time, context 
+ * switches, wakeups) and the counters of the game loop, shown in the stats
+ * overlay and in the exit summary.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdatomic.h>
+#include "support.h"
+
+#define STATS_INTERVAL 500 /*!< time in ms between overlay updates */
+#define STATS_ROW 0 /*!< top row of the stats overlay */
+#define STATS_COL 3 /*!< left column of the stats overlay */
+#define THREAD_MAIN 0 /*!< stats slot for the main (controller) thread */
+#define THREAD_KBD 1 /*!< stats slot for the keyboard thread */
+#define THREAD_AI 2 /*!< stats slot for the ai thread */
+#define THREAD_BALL 3 /*!< stats slot for the ball thread */
+#define THREAD_SIGNAL 4 /*!< stats slot for the signal listener thread */
+#define THREAD_METRICS 5 /*!< stats slot for the metrics server thread */
+#define STATS_THREADS 6 /*!< number of stats slots */
+#define SOAK_SAMPLES 100 /*!< resource samples taken during a soak test */
+
+/*!
+ * Accounting for one thread slot. Each game thread is created once and 
+ * lives until the program exits, so a slot holds a single thread; its 
+ * values are accumulated into the *_done fields when it terminates, so 
+ * that the summary printed at exit still has them.
+ */
+typedef struct {
+    pid_t tid; /*!< kernel id of the thread, 0 if not running */
+    clockid_t clock; /*!< cpu clock of the thread */
+    long cpu_ns_done; /*!< cpu time of the thread, once terminated */
+    long vcsw_done; /*!< voluntary switches, once terminated */
+    long ivcsw_done; /*!< involuntary switches, once terminated */
+    atomic_long wakeups; /*!< times the thread has woken up */
+} thread_stats;
+
+/*!
+ * Counters shared by all threads. Counters on the hot path are atomics 
+ * updated with relaxed ordering.
+ */
+typedef struct {
+    thread_stats thread[STATS_THREADS]; /*!< per-thread accounting */
+    pthread_mutex_t mut; /*!< protects the non-atomic thread fields */
+    struct timespec start; /*!< instant of stats_init */
+    atomic_long lock_count; /*!< acquisitions of data.mut */
+    atomic_long lock_contended; /*!< acquisitions which had to wait */
+    atomic_long lock_wait_ns; /*!< time spent waiting for data.mut */
+    atomic_long pipe_messages; /*!< messages read by the controller */
+    atomic_long resize_events; /*!< SIGWINCH received */
+    atomic_long relayouts; /*!< field re-layouts after resize */
+    atomic_long frames; /*!< ball frames drawn */
+    atomic_long frames_dropped; /*!< ball frames drawn late or skipped */
+    atomic_long matches_won; /*!< matches won by the player */
+    atomic_long matches_lost; /*!< matches won by the ai */
+    atomic_long ticks; /*!< ball thread wake ups */
+    atomic_long tick_late_us; /*!< lateness of the wake ups, summed */
+    atomic_long tick_late_max_us; /*!< max lateness of a wake up */
+    atomic_long steps; /*!< ball ticks stepped */
+    atomic_long step_ns; /*!< time spent stepping the balls */
+    atomic_long step_balls; /*!< balls stepped, summed over the ticks */
+    atomic_int balls; /*!< balls stepped in the last tick */
+    atomic_long snapshots; /*!< ticks recorded for rewind */
+    atomic_long snapshot_ns; /*!< time spent recording ticks */
+    atomic_long snapshot_bytes; /*!< bytes of the tick records */
+    atomic_long restores; /*!< rewinds */
+    atomic_long restore_ns; /*!< time spent restoring ticks */
+} game_stats;
+
+extern game_stats stats; /*!< process wide counters */
+
+/*!
+ * \brief Initialize the counters. Must be called before any thread starts.
+ */
+void stats_init(void);
+
+/*!
+ * \brief Register the calling thread in a stats slot.
+ *
+ * @param slot stats slot (THREAD_*)
+ */
+void stats_thread_start(int slot);
+
+/*!
+ * \brief Account the final figures of the calling thread, which is going 
+ * to terminate.
+ *
+ * @param slot stats slot the thread registered in
+ */
+void stats_thread_stop(int slot);
+
+/*!
+ * \brief Count a wake up of the thread in a slot.
+ *
+ * @param slot stats slot (THREAD_*)
+ */
+void stats_wakeup(int slot);
+
+/*!
+ * \brief Start counting ball frames for a new game.
+ *
+ * @param tick_us time in us between ball ticks
+ */
+void stats_frames_start(int tick_us);
+
+/*!
+ * \brief Count a ball frame drawn by the controller. A frame arriving more
+ * than two ticks after the previous one accounts for the ticks which 
+ * were not drawn on time.
+ */
+void stats_frame(void);
+
+/*!
+ * \brief Account a wake up of the ball thread.
+ *
+ * @param late_us time in us between the expected and the actual wake up
+ */
+void stats_tick(long late_us);
+
+/*!
+ * \brief Account the cost of a ball tick.
+ *
+ * @param ns time spent stepping the balls
+ * @param balls balls stepped
+ */
+void stats_step(long ns, int balls);
+
+/*!
+ * \brief Account a tick recorded for rewind.
+ *
+ * @param ns time spent recording
+ * @param bytes size of the record
+ */
+void stats_snapshot(long ns, int bytes);
+
+/*!
+ * \brief Account a rewind.
+ *
+ * @param ns time spent restoring the tick
+ */
+void stats_restore(long ns);
+
+/*!
+ * \brief Return the bytes written to the terminal by the main thread.
+ *
+ * @return bytes written, 0 if unknown
+ */
+long stats_terminal_bytes(void);
+
+/*!
+ * \brief Draw the stats overlay on the top of the window, with rates 
+ * computed since the previous call.
+ *
+ * @param win ncurses window
+ */
+void stats_draw(WINDOW *win);
+
+/*!
+ * \brief Blank the area covered by the stats overlay.
+ *
+ * @param win ncurses window
+ */
+void stats_erase(WINDOW *win);
+
+/*!
+ * \brief Print totals and averages over the whole run.
+ *
+ * @param out output stream
+ */
+void stats_summary(FILE *out);
+
+/*!
+ * \brief Record resident memory, thread count and open file descriptors
+ * of the process during a soak test.
+ *
+ * @param match matches played so far
+ */
+void stats_soak_sample(long match);
+
+/*!
+ * \brief Print the resource samples of the soak test and their drift.
+ *
+ * @param out output stream
+ */
+void stats_soak_report(FILE *out);
+
+#endif /* STATS_H */
@@ -25,6 +25,11 @@
  */
 
 #include "support.h"
+#include "realtime.h"
+#include "stats.h"
+#include "ai.h"
+#include "balls.h"
+#include "rewind.h"
 
 /*!
  */
@@ -33,6 +38,8 @@ void *signal_listener(void *d)
     game_data *data = (game_data*) d;
     struct signalfd_siginfo signal_info;
 
+    stats_thread_start(THREAD_SIGNAL);
+
     /* create poll to wait on signal file descriptor */
     struct pollfd pfd[1];
     pfd[0].fd = data->signal_fd;
@@ -41,8 +48,11 @@ void *signal_listener(void *d)
     while (1)
     {
         /* wait for event on signal fd and then read signal from pipe */
-        poll(pfd, 1, 1);
-        read(data->signal_fd, &signal_info, sizeof (struct signalfd_siginfo));
+        poll(pfd, 1, -1);
+        if (read(data->signal_fd, &signal_info, sizeof signal_info)
+                != sizeof signal_info)
+            continue;
+        stats_wakeup(THREAD_SIGNAL);
 
         /* manage signal */
         switch (signal_info.ssi_signo)
@@ -55,10 +65,12 @@ void *signal_listener(void *d)
                 break;
 
             case SIGWINCH:
-                /* resize field (critical section) */
-                pthread_mutex_lock(&data->mut);
-                resize_handler(data);
-                pthread_mutex_unlock(&data->mut);
+                /* coalesce resizes: wake the controller only for the 
+                 * first one since the last re-layout */
+                atomic_fetch_add_explicit(
+                        &stats.resize_events, 1, memory_order_relaxed);
+                if (!atomic_exchange(&data->resize_pending, 1))
+                    write(data->pipedes[1], RESIZE_TAG, TAG_SIZE);
                 break;
 
             default:
@@ -68,60 +80,244 @@ void *signal_listener(void *d)
     }
 }
 
+/*
+ * Map a coordinate from the range [0, from] to the range [0, to].
+ */
+static int rescale(int v, int from, int to)
+{
+    return from > 0 ? (v * to + from / 2) / from : v;
+}
+
 /*!
- * This procedure is an handler to manage window resize.
+ * This procedure is an handler to manage window resize. The window is 
+ * erased, not cleared: ncurses keeps the screen content across resizeterm,
+ * so the next refresh sends the damaged cells only. Nothing is reallocated
+ * when the size did not change since the last layout.
  */
 void resize_handler(game_data *data)
 {
     struct winsize ws;
+    ball_state *b;
+    int i;
+    int old_bottom = LINES * data->opt.vscale - 1;
+    int old_right = COLS - 1;
 
-    ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws); /* get terminal size */
-    wresize(stdscr, ws.ws_row, ws.ws_col); /* resize ncurses window */
+    /* get terminal size */
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1
+            || (ws.ws_row == LINES && ws.ws_col == COLS))
+        return;
 
-    endwin();
+    atomic_fetch_add_explicit(&stats.relayouts, 1, memory_order_relaxed);
+
+    erase(); /* delete the objects from the old layout */
+    resizeterm(ws.ws_row, ws.ws_col); /* resize ncurses screen */
 
     /* update field size */
-    data->bottom_row = getmaxy(stdscr) - 1;
+    data->bottom_row = getmaxy(stdscr) * data->opt.vscale - 1;
     data->paddle_col = getmaxx(stdscr) - 1;
 
-    /* ensure objects are inside the new field */
-    if (data->paddle_pos > data->bottom_row - PADDLE_WIDTH / 2)
-        data->paddle_pos = MAX(
-                data->bottom_row - PADDLE_WIDTH / 2,
-                PADDLE_WIDTH / 2); /* avoid the paddle to go above top row */
-    if (data->ai_paddle_pos > data->bottom_row - PADDLE_WIDTH / 2)
-        data->ai_paddle_pos = MAX(
-                data->bottom_row - PADDLE_WIDTH / 2,
-                PADDLE_WIDTH / 2);
-    if (data->ball_y > data->bottom_row)
-        data->ball_y = data->bottom_row;
-    if (data->ball_x > getmaxx(stdscr))
-        data->ball_y = getmaxx(stdscr) / 2;
-
-    /* update screen content */
-    clear();
+    /* rescale objects to the new field, keeping paddles inside it (but 
+     * never above the top row) and the balls between the paddles */
+    data->paddle_pos = MAX(PADDLE_WIDTH / 2, MIN(
+                rescale(data->paddle_pos, old_bottom, data->bottom_row),
+                data->bottom_row - PADDLE_WIDTH / 2));
+    data->ai_paddle_pos = MAX(PADDLE_WIDTH / 2, MIN(
+                rescale(data->ai_paddle_pos, old_bottom, data->bottom_row),
+                data->bottom_row - PADDLE_WIDTH / 2));
+    data->ball_y = MAX(FIELD_TOP, MIN(
+                rescale(data->ball_y, old_bottom, data->bottom_row),
+                data->bottom_row));
+    data->ball_x = data->ai_paddle_col + rescale(
+            data->ball_x - data->ai_paddle_col,
+            old_right - data->ai_paddle_col,
+            data->paddle_col - data->ai_paddle_col);
+    data->ball_x = MAX(data->ai_paddle_col + 1, 
+            MIN(data->ball_x, data->paddle_col - 1));
+
+    for (i = 0; i < data->pool.count; ++i)
+    {
+        b = &data->pool.ball[i];
+        b->y = MAX(FIELD_TOP, MIN(
+                    rescale(b->y, old_bottom, data->bottom_row),
+                    data->bottom_row));
+        b->x = data->ai_paddle_col + rescale(
+                b->x - data->ai_paddle_col,
+                old_right - data->ai_paddle_col,
+                data->paddle_col - data->ai_paddle_col);
+        b->x = MAX(data->ai_paddle_col + 1, 
+                MIN(b->x, data->paddle_col - 1));
+    }
+    if (data->opt.balls && pool_layout(data, LINES * COLS))
+    {
+        /* out of memory: end the game, the ball thread checks the flags
+         * before stepping the pool again */
+        data->exit_flag = 1;
+        data->termination_flag = 1;
+    }
+    data->pool.drawn = 0;
+
+    data->paddle_pos_old = data->paddle_pos;
+    data->ai_paddle_pos_old = data->ai_paddle_pos;
+    data->ball_x_old = data->ball_x;
+    data->ball_y_old = data->ball_y;
+
+    /* draw the objects in the new layout */
     draw_paddle(data, AI_TAG);
     draw_paddle(data, KBD_TAG);
     draw_ball(data);
-    refresh();
+}
+
+long elapsed_us(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000L
+        + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+long elapsed_ns(const struct timespec *from, const struct timespec *to)
+{
+    return (to->tv_sec - from->tv_sec) * 1000000000L
+        + (to->tv_nsec - from->tv_nsec);
+}
+
+/*!
+ * The uncontended path costs one trylock and a relaxed increment.
+ */
+void lock_game(game_data *data)
+{
+    struct timespec before, after; /* instants around a contended lock */
+
+    atomic_fetch_add_explicit(&stats.lock_count, 1, memory_order_relaxed);
+    if (pthread_mutex_trylock(&data->mut) == 0)
+        return;
+
+    /* the wait is timed on the contended path only */
+    atomic_fetch_add_explicit(&stats.lock_contended, 1, memory_order_relaxed);
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    pthread_mutex_lock(&data->mut);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    atomic_fetch_add_explicit(&stats.lock_wait_ns, 
+            elapsed_ns(&before, &after), memory_order_relaxed);
+}
+
+void unlock_game(game_data *data)
+{
+    pthread_mutex_unlock(&data->mut);
+}
+
+/*!
+ * ncurses may hold keys already read from the terminal in its own buffer, 
+ * so the file descriptor is polled only when getch has nothing to return.
+ * When the input is at end of file or hung up (e.g. a game started in the
+ * background with no terminal on stdin), poll returns at once and getch 
+ * has nothing to read: the timeout is then slept, so that the keyboard 
+ * thread does not spin.
+ */
+int read_key(game_data *data, int timeout)
+{
+    int ch;
+    struct pollfd pfd[1];
+
+    /* get user input (critical section) */
+    lock_game(data);
+    ch = getch(); 
+    unlock_game(data);
+
+    if (ch != ERR)
+        return ch;
+
+    /* nothing buffered, sleep until the terminal has input */
+    pfd[0].fd = STDIN_FILENO;
+    pfd[0].events = POLLIN;
+    if (poll(pfd, 1, timeout) <= 0)
+        return ERR;
+
+    if (!(pfd[0].revents & (POLLHUP | POLLERR | POLLNVAL)))
+    {
+        lock_game(data);
+        ch = getch(); 
+        unlock_game(data);
+
+        if (ch != ERR)
+            return ch;
+    }
+
+    /* readable but no key: the input is gone, do not retry at once */
+    poll(NULL, 0, timeout);
+
+    return ERR;
+}
+
+/*!
+ * Workers park here at the end of each game. The last one to park wakes 
+ * the controller, which may be waiting in wait_workers_parked before 
+ * setting up the next game.
+ */
+int wait_next_game(game_data *data, int *game)
+{
+    int run;
+
+    pthread_mutex_lock(&data->park_mut);
+    data->parked++;
+    pthread_cond_broadcast(&data->park_cond);
+    while (data->game == *game && !data->exit_flag)
+        pthread_cond_wait(&data->park_cond, &data->park_mut);
+    data->parked--;
+    *game = data->game;
+    run = !data->exit_flag;
+    pthread_mutex_unlock(&data->park_mut);
+
+    return run;
+}
+
+void start_game(game_data *data)
+{
+    pthread_mutex_lock(&data->park_mut);
+    data->play_flag = 1;
+    data->termination_flag = 0;
+    data->game++;
+    pthread_cond_broadcast(&data->park_cond);
+    pthread_mutex_unlock(&data->park_mut);
+}
+
+void wait_workers_parked(game_data *data)
+{
+    pthread_mutex_lock(&data->park_mut);
+    while (data->parked < PARKED_WORKERS)
+        pthread_cond_wait(&data->park_cond, &data->park_mut);
+    pthread_mutex_unlock(&data->park_mut);
+}
+
+void stop_workers(game_data *data)
+{
+    pthread_mutex_lock(&data->park_mut);
+    data->exit_flag = 1;
+    data->termination_flag = 1;
+    pthread_cond_broadcast(&data->park_cond);
+    pthread_mutex_unlock(&data->park_mut);
 }
 
 /*!
- * This procedure is a listener for keyboard input during the game.
- * When a player press a key, the input triggers the related action and a 
- * message to the game main thread is sent throug the pipe.
+ * This procedure is a listener for keyboard input, for the whole program
+ * life. When a player press a key, the input triggers the related action
+ * and a message to the game main thread is sent throug the pipe.
  */
 void *keyboard_handler(void *d)
 {
     game_data *data = (game_data*) d;
-    while (!data->termination_flag)
+
+    rt_thread(&data->opt, ROLE_INPUT);
+    stats_thread_start(THREAD_KBD);
+
+    while (!data->exit_flag)
     {
-        int ch;
+        int ch = read_key(data, KEY_POLL_TIMEOUT);
+        stats_wakeup(THREAD_KBD);
 
-        /* get user input (critical section) */
-        pthread_mutex_lock(&data->mut);
-        ch = getch(); 
-        pthread_mutex_unlock(&data->mut);
+        /* paddle keys act only during a game, when the paddle is not 
+         * driven by the autopilot */
+        if ((ch == KEY_UP || ch == KEY_DOWN) 
+                && (!data->play_flag || data->opt.soak_matches))
+            continue;
 
         switch (ch)
         {
@@ -142,8 +338,20 @@ void *keyboard_handler(void *d)
                 break;
 
             case PLAY_KEY:
-                /* set flag to play a new game */
-                data->play_flag = 1;
+                /* ask the controller to play a new game */
+                write(data->pipedes[1], PLAY_TAG, TAG_SIZE);
+                break;
+
+            case REWIND_KEY:
+                /* ask the ball thread to rewind, when recording */
+                if (data->play_flag && data->opt.rewind_seconds)
+                    atomic_store(&data->rewind_request, 1);
+                break;
+
+            case STATS_KEY:
+                /* toggle the stats overlay */
+                data->stats_flag = !data->stats_flag;
+                write(data->pipedes[1], STATS_TAG, TAG_SIZE);
                 break;
 
             case QUIT_KEY:
@@ -158,121 +366,322 @@ void *keyboard_handler(void *d)
                 break;
         }
     }
+
+    stats_thread_stop(THREAD_KBD);
     
     return 0;
 }
 
+void reset_field(game_data *data, int diry)
+{
+    /* init player paddle */
+    data->paddle_pos = (PADDLE_WIDTH / 2 
+            + data->bottom_row - PADDLE_WIDTH / 2) / 2;
+    data->paddle_pos_old = data->paddle_pos;
+
+    /* init ai paddle */
+    data->ai_paddle_pos = data->paddle_pos;
+    data->ai_paddle_pos_old = data->ai_paddle_pos;
+
+    /* init ball */
+    data->ball_x_old = data->ball_x = data->paddle_col - 1;
+    data->ball_y_old = data->ball_y = data->paddle_pos;
+    data->ball_dirx = -1;
+    data->ball_diry = diry;
+}
+
 /*!
- * This procedure is responsible for ball movement. The ball position is 
- * updated every TIME_GAP_BALL microseconds, and then a message to the 
- * game main thread is sent throug the pipe.
+ * The same physics drives the ball thread and the headless matches of the
+ * tuner.
  */
-void *ball_handler(void *d)
+int ball_step(game_data *data)
 {
-    game_data *data = (game_data*) d;
+    /* update ball coordinates */
+    data->ball_y_old = data->ball_y;
+    data->ball_x_old = data->ball_x;
+    data->ball_y += data->ball_diry;
+    data->ball_x += data->ball_dirx;
+
+    /* reflect ball on field top and bottom */
+    if (data->ball_y < FIELD_TOP || data->ball_y > data->bottom_row) 
+    {
+        data->ball_diry *= -1;
+        data->ball_y += 2 * data->ball_diry;
+    }
 
-    while (1)
+    /* reflect ball on player pad */
+    if (data->ball_x >= data->paddle_col)
     {
-        /* update ball coordinates */
-        data->ball_y_old = data->ball_y;
-        data->ball_x_old = data->ball_x;
-        data->ball_y += data->ball_diry;
-        data->ball_x += data->ball_dirx;
-
-        /* reflect ball on field top and bottom */
-        if (data->ball_y < FIELD_TOP || data->ball_y > data->bottom_row) 
+        if (abs(data->paddle_pos - data->ball_y - -data->ball_diry) 
+                <= PADDLE_WIDTH / 2)
         {
-            data->ball_diry *= -1;
-            data->ball_y += 2 * data->ball_diry;
+            /* ball is above the pad; consider one extra on length
+             * because the ball is moving diagonally */
+            data->ball_dirx *= -1;
+            data->ball_x = data->paddle_col + 2 * data->ball_dirx;
+        } else {
+            /* ball is out, player loses, ai wins */
+            data->winner = 1;
+            return BALL_OUT;
         }
+    }
 
-        /* reflect ball on player pad */
-        if (data->ball_x == data->paddle_col)
+    /* reflect ball on AI pad */
+    if (data->ball_x <= data->ai_paddle_col)
+    {
+        if (abs(data->ai_paddle_pos - data->ball_y - -data->ball_diry) 
+                <= PADDLE_WIDTH / 2)
         {
-            if (abs(data->paddle_pos - data->ball_y - -data->ball_diry) 
-                    <= PADDLE_WIDTH / 2)
-            {
-                /* ball is above the pad; consider one extra on length
-                 * because the ball is moving diagonally */
-                data->ball_dirx *= -1;
-                data->ball_x += 2 * data->ball_dirx;
-            } else {
-                /* ball is out */
-                data->play_flag = 0;
+            /* ball is above the pad; consider one extra on length
+             * because the ball is moving diagonally */
+            data->ball_dirx *= -1;
+            data->ball_x = data->ai_paddle_col + 2 * data->ball_dirx;
+        } else {
+            /* ball is out, ai loses, player wins */
+            data->winner = 0;
+            return BALL_OUT;
+        }
+    }
 
-                /* player loses, ai wins */
-                data->winner = 1;
+    return BALL_IN;
+}
 
-                /* dummy write to unlock the controller waiting
-                 * at the other pipe end */
-                write(data->pipedes[1], QUIT_TAG, TAG_SIZE);
+/*
+ * Record the current tick into the rewind buffer, accounting its cost.
+ */
+static void record_tick(rewind_buffer *rw, const game_data *data)
+{
+    struct timespec before, after;
+    int bytes;
 
-                /* thread termination */
-                return 0;
-            }
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    bytes = rewind_record(rw, data);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    stats_snapshot(elapsed_ns(&before, &after), bytes);
+}
+
+/*
+ * Bring the game back by REWIND_STEP_S seconds, in a critical section so
+ * that the controller does not draw a half restored field.
+ */
+static void rewind_game(rewind_buffer *rw, game_data *data)
+{
+    struct timespec before, after;
+
+    lock_game(data);
+    clock_gettime(CLOCK_MONOTONIC, &before);
+    rewind_restore(rw, data, REWIND_STEP_S * 1000000L / data->tick_us);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    data->paddle_pos_old = data->paddle_pos;
+    data->ai_paddle_pos_old = data->ai_paddle_pos;
+    data->ball_x_old = data->ball_x;
+    data->ball_y_old = data->ball_y;
+    unlock_game(data);
+
+    stats_restore(elapsed_ns(&before, &after));
+}
+
+/*!
+ * This procedure is responsible for ball movement. The ball position is 
+ * updated every tick_us microseconds, and then a message to the 
+ * game main thread is sent throug the pipe. When the ball is out the
+ * thread parks until the next game. If rewind is enabled each tick is 
+ * recorded, and on request the thread rewinds the game instead of moving
+ * the ball.
+ */
+void *ball_handler(void *d)
+{
+    game_data *data = (game_data*) d;
+    struct timespec before, after; /* instants around the step and sleep */
+    int game = 0; /* last game played */
+    int out; /* the step left no ball in play */
+    int balls; /* balls stepped in a tick */
+    long late; /* lateness of the wake up, in us */
+    rewind_buffer rw; /* ticks recorded for rewind, owned by this thread */
+
+    jitter_start(&data->opt); /* applies ROLE_SIM, maybe after a baseline */
+    stats_thread_start(THREAD_BALL);
+
+    /* without memory the rewind requests are ignored */
+    memset(&rw, 0, sizeof rw);
+    if (data->opt.rewind_seconds)
+        rewind_init(&rw, data->opt.rewind_seconds, data->tick_us);
+
+    while (wait_next_game(data, &game))
+    {
+        if (rw.size)
+        {
+            rewind_clear(&rw);
+            atomic_store(&data->rewind_request, 0);
+            record_tick(&rw, data);
         }
 
-        /* reflect ball on AI pad */
-        if (data->ball_x == data->ai_paddle_col)
+        while (!data->termination_flag)
         {
-            if (abs(data->ai_paddle_pos - data->ball_y - -data->ball_diry) 
-                    <= PADDLE_WIDTH / 2)
+            stats_wakeup(THREAD_BALL);
+
+            if (rw.size && atomic_exchange(&data->rewind_request, 0))
             {
-                /* ball is above the pad; consider one extra on length
-                 * because the ball is moving diagonally */
-                data->ball_dirx *= -1;
-                data->ball_x += 2 * data->ball_dirx;
+                rewind_game(&rw, data);
+                write(data->pipedes[1], REWIND_TAG, TAG_SIZE);
             } else {
-                /* ball is out */
-                data->play_flag = 0;
-
-                /* ai loses, player wins */
-                data->winner = 0;
-
-                /* dummy write to unlock the controller waiting
-                 * at the other pipe end */
-
-                write(data->pipedes[1], QUIT_TAG, TAG_SIZE);
-
-                /* thread termination */
-                return 0;
+                /* the pool is stepped in a critical section, since the
+                 * controller draws it ball by ball */
+                if (data->opt.balls)
+                {
+                    lock_game(data);
+                    if (data->termination_flag) /* failed re-layout */
+                    {
+                        unlock_game(data);
+                        break;
+                    }
+                }
+                balls = data->opt.balls ? data->pool.count : 1;
+                clock_gettime(CLOCK_MONOTONIC, &before);
+                out = data->opt.balls ? pool_step(data) : ball_step(data);
+                clock_gettime(CLOCK_MONOTONIC, &after);
+                stats_step(elapsed_ns(&before, &after), balls);
+                if (data->opt.balls)
+                    unlock_game(data);
+
+                if (out == BALL_OUT)
+                {
+                    data->play_flag = 0;
+
+                    /* dummy write to unlock the controller waiting
+                     * at the other pipe end */
+                    write(data->pipedes[1], QUIT_TAG, TAG_SIZE);
+
+                    /* wait for next game */
+                    break;
+                }
+
+                if (rw.size)
+                    record_tick(&rw, data);
+
+                write(data->pipedes[1], BALL_TAG, TAG_SIZE);
             }
+
+            /* sleep until next tick, measuring how late the wake up is */
+            clock_gettime(CLOCK_MONOTONIC, &before);
+            usleep(data->tick_us);
+            clock_gettime(CLOCK_MONOTONIC, &after);
+            late = elapsed_us(&before, &after) - data->tick_us;
+            jitter_record(late);
+            stats_tick(late);
         }
+    }
 
-        write(data->pipedes[1], BALL_TAG, TAG_SIZE);
+    rewind_free(&rw);
+    stats_thread_stop(THREAD_BALL);
 
-        usleep(TIME_GAP_BALL);
-    }
+    return 0;
 }
 
 /*!
- * This procedure controls the ai pad. Movements are generated every 
- * TIME_GAP_AI microseconds, and then a message is sent to the game main
- * thread throug the pipe.
+ * This procedure controls the ai pad, following the ai policy. Movements
+ * are generated every ai_tick_us microseconds, and then a message is sent
+ * to the game main thread throug the pipe. In soak mode it drives the 
+ * player pad too, following the autopilot policy.
  */
 void *ai_handler(void *d)
 {
     game_data *data = (game_data*) d;
-    
-    while (!data->termination_flag)
+    int game = 0; /* last game played */
+    ai_state ai; /* state of the ai policy */
+    ai_state autopilot; /* state of the player policy in soak mode */
+
+    rt_thread(&data->opt, ROLE_SIM);
+    stats_thread_start(THREAD_AI);
+
+    while (wait_next_game(data, &game))
     {
-        int diff = data->ball_y - data->ai_paddle_pos;
-        int new = data->ai_paddle_pos + diff / (diff == 0 ? 1 : abs(diff));
+        ai_reset(&ai, data, getpid() + game);
+        ai_reset(&autopilot, data, ~(getpid() + game));
 
-        data->ai_paddle_pos_old = data->ai_paddle_pos;
+        while (!data->termination_flag)
+        {
+            stats_wakeup(THREAD_AI);
 
-        if (new >= PADDLE_WIDTH / 2 
-                && new <= data->bottom_row - PADDLE_WIDTH / 2)
-            data->ai_paddle_pos = new;
+            ai_move(&data->opt.ai, &ai, data, AI_SIDE);
+            if (data->opt.soak_matches)
+            {
+                ai_move(&data->opt.autopilot, &autopilot, data, PLAYER_SIDE);
+                write(data->pipedes[1], KBD_TAG, TAG_SIZE);
+            }
 
-        write(data->pipedes[1], AI_TAG, TAG_SIZE);
-        
-        usleep(TIME_GAP_AI);
+            write(data->pipedes[1], AI_TAG, TAG_SIZE);
+            
+            usleep(data->ai_tick_us);
+        }
     }
+
+    stats_thread_stop(THREAD_AI);
     
     return 0;
 }
 
+/*
+ * Return the glyph showing the sub-rows of a cell set in mask (one bit per
+ * sub-row, from the top), with half blocks or braille dots.
+ */
+static wchar_t cell_glyph(int mask, int vscale)
+{
+    static const wchar_t half[4] = {L' ', 0x2580, 0x2584, 0x2588};
+    static const int dots[4] = {0x09, 0x12, 0x24, 0xc0}; /* braille rows */
+    int i;
+    int glyph = 0;
+
+    if (vscale == 2 || !mask)
+        return half[mask];
+
+    for (i = 0; i < 4; ++i)
+        if (mask & (1 << i))
+            glyph |= dots[i];
+    return 0x2800 + glyph;
+}
+
+/*
+ * Return the mask of the sub-rows of a cell row covered by the simulation
+ * rows from lo to hi.
+ */
+static int cell_mask(int row, int lo, int hi, int vscale)
+{
+    int i;
+    int mask = 0;
+
+    for (i = 0; i < vscale; ++i)
+        if (row * vscale + i >= lo && row * vscale + i <= hi)
+            mask |= 1 << i;
+    return mask;
+}
+
+/*
+ * Write a glyph with the given color pair.
+ */
+static void put_glyph(int row, int col, wchar_t glyph, short pair)
+{
+    cchar_t cc;
+    wchar_t str[2];
+
+    str[0] = glyph;
+    str[1] = L'\0';
+    setcchar(&cc, str, A_NORMAL, pair, NULL);
+    mvadd_wch(row, col, &cc);
+}
+
+/*
+ * Blank a cell in high resolution mode. The blank takes the ball color 
+ * pair, which has the same black background as the default one and is 
+ * also the window background in this mode: keeping the field in the pairs
+ * of the glyphs spares the terminal a full attribute reset each time 
+ * ncurses moves from a glyph to a blank.
+ */
+static void blank_glyph(int row, int col)
+{
+    put_glyph(row, col, L' ', BALL_COLOR);
+}
+
 /*!
  * This procedure cancels the pad from the previous position according
  * to the shared game_data structure. The second parameter permits to 
@@ -284,6 +693,19 @@ void delete_paddle(game_data *data, char *tag)
     int type = !strcmp(tag, KBD_TAG); /* 1 for player, 0 for ai */
     int row = (type ? data->paddle_pos_old : data->ai_paddle_pos_old)
         - PADDLE_WIDTH / 2; /* base row */
+    int v = data->opt.vscale;
+
+    if (v > 1)
+    {
+        /* high resolution: delete only the cells the paddle has left, the
+         * others get a new glyph from draw_paddle */
+        int pos = type ? data->paddle_pos : data->ai_paddle_pos;
+        for (i = row / v; i <= (row + PADDLE_WIDTH - 1) / v; ++i)
+            if (!cell_mask(i, pos - PADDLE_WIDTH / 2, 
+                        pos + PADDLE_WIDTH / 2, v))
+                blank_glyph(i, type ? data->paddle_col : data->ai_paddle_col);
+        return;
+    }
 
     /* delete all points from base row for all the paddle length */
     for (i = 0; i < PADDLE_WIDTH ; ++i)
@@ -304,6 +726,21 @@ void draw_paddle(game_data *data, char *tag)
     int type = !strcmp(tag, KBD_TAG); /* 1 for player, 0 for ai */
     int row = (type ? data->paddle_pos : data->ai_paddle_pos) 
         - PADDLE_WIDTH / 2; /* base row */
+    int v = data->opt.vscale;
+
+    if (v > 1)
+    {
+        /* high resolution: draw the cells covered by the paddle, with a 
+         * glyph showing which of their sub-rows are covered */
+        for (i = row / v; i <= (row + PADDLE_WIDTH - 1) / v; ++i)
+            put_glyph(
+                    i,
+                    type ? data->paddle_col : data->ai_paddle_col,
+                    cell_glyph(cell_mask(i, row, row + PADDLE_WIDTH - 1, v),
+                        v),
+                    type ? PADDLE_HR_COLOR : AI_HR_COLOR);
+        return;
+    }
 
     /* delete all points from base row for all the paddle length */
     for (i = 0; i < PADDLE_WIDTH ; ++i)
@@ -319,11 +756,102 @@ void draw_paddle(game_data *data, char *tag)
 
 void delete_ball(game_data *data)
 {
-    mvaddch(data->ball_y_old, data->ball_x_old, ' ');  
+    int v = data->opt.vscale;
+
+    /* in multi-ball mode draw_ball deletes the last frame */
+    if (data->opt.balls)
+        return;
+
+    if (v == 1)
+    {
+        mvaddch(data->ball_y_old, data->ball_x_old, ' ');  
+        return;
+    }
+
+    /* in high resolution the ball may still be in the same cell, which 
+     * then gets a new glyph from draw_ball */
+    if (data->ball_x != data->ball_x_old
+            || data->ball_y / v != data->ball_y_old / v)
+        blank_glyph(data->ball_y_old / v, data->ball_x_old);
+}
+
+/*
+ * Redraw the balls of the pool, deleting the cells drawn in the last 
+ * frame. In high resolution, balls sharing a cell are merged into one 
+ * glyph.
+ */
+static void draw_pool(game_data *data)
+{
+    ball_pool *pool = &data->pool;
+    int v = data->opt.vscale;
+    int cols = getmaxx(stdscr);
+    ball_state *b;
+    int cell;
+    int i;
+
+    for (i = 0; i < pool->drawn; ++i)
+        if (v > 1)
+            blank_glyph(pool->drawn_y[i], pool->drawn_x[i]);
+        else
+            mvaddch(pool->drawn_y[i], pool->drawn_x[i], ' ');
+    pool->drawn = 0;
+
+    if (v == 1)
+    {
+        attron(COLOR_PAIR(BALL_COLOR));
+        for (i = 0; i < pool->count; ++i)
+        {
+            b = &pool->ball[i];
+            mvaddch(b->y, b->x, 'o');
+            pool->drawn_x[pool->drawn] = b->x;
+            pool->drawn_y[pool->drawn++] = b->y;
+        }
+        attroff(COLOR_PAIR(BALL_COLOR));
+        return;
+    }
+
+    /* collect the sub-rows of each cell, then draw each cell once */
+    for (i = 0; i < pool->count; ++i)
+    {
+        b = &pool->ball[i];
+        cell = b->y / v * cols + b->x;
+        if (cell < pool->mask_size)
+            pool->mask[cell] |= 1 << b->y % v;
+    }
+    for (i = 0; i < pool->count; ++i)
+    {
+        b = &pool->ball[i];
+        cell = b->y / v * cols + b->x;
+        if (cell >= pool->mask_size || !pool->mask[cell])
+            continue;
+        put_glyph(b->y / v, b->x, cell_glyph(pool->mask[cell], v), 
+                BALL_COLOR);
+        pool->mask[cell] = 0;
+        pool->drawn_x[pool->drawn] = b->x;
+        pool->drawn_y[pool->drawn++] = b->y / v;
+    }
 }
 
 void draw_ball(game_data *data)
 {
+    int v = data->opt.vscale;
+
+    if (data->opt.balls)
+    {
+        draw_pool(data);
+        return;
+    }
+
+    if (v > 1)
+    {
+        put_glyph(
+                data->ball_y / v,
+                data->ball_x,
+                cell_glyph(1 << data->ball_y % v, v),
+                BALL_COLOR);
+        return;
+    }
+
     attron(COLOR_PAIR(BALL_COLOR));
     mvaddch(data->ball_y, data->ball_x, 'o');
     attroff(COLOR_PAIR(BALL_COLOR));
@@ -25,6 +25,9 @@
  * @date 2014-11-23
  */
 
+#ifndef SUPPORT_H
+#define SUPPORT_H
+
 #include <ncurses.h>
 #include <sys/ioctl.h>
 #include <sys/signalfd.h>
@@ -35,6 +38,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <poll.h>
+#include <stdatomic.h>
 
 #define TIME_GAP_BALL 25000 /*!< time in us between ball position update */
 #define TIME_GAP_AI 25000 /*!< time in us between ai position update */
@@ -45,13 +49,33 @@
 #define BALL_COLOR 2 /*!< color pair identifier for ball */
 #define AI_COLOR 3 /*!< color pair identifier for ai paddle */
 #define TITLE_COLOR 4 /*!< color pair identifier for title writing */
+#define PADDLE_HR_COLOR 5 /*!< color pair for player paddle glyphs */
+#define AI_HR_COLOR 6 /*!< color pair for ai paddle glyphs */
 #define KBD_TAG "k" /*!< tag describing data from keyboadrd thread */
 #define AI_TAG "a" /*!< tag describing data from ai thread */
 #define BALL_TAG "b" /*!< tag describing data from ball thread */
 #define QUIT_TAG "q" /*!< tag describing quit request */
+#define RESIZE_TAG "r" /*!< tag describing a pending window resize */
+#define PLAY_TAG "p" /*!< tag describing new game request */
 #define TAG_SIZE sizeof "k"  /*!< size of tags */
 #define QUIT_KEY 'q' /*!< key for game termination */
 #define PLAY_KEY ' ' /*!< key for game start */
+#define STATS_KEY 's' /*!< key for stats overlay toggle */
+#define STATS_TAG "s" /*!< tag describing stats overlay toggle */
+#define REWIND_KEY 'r' /*!< key for rewinding the game */
+#define REWIND_TAG "w" /*!< tag describing a game rewound */
+#define KEY_POLL_TIMEOUT 100 /*!< max ms a key read blocks: 10 wakes/s */
+#define ROLE_SIM 0 /*!< thread role for ball and ai threads */
+#define ROLE_INPUT 1 /*!< thread role for the keyboard thread */
+#define ROLE_RENDER 2 /*!< thread role for the main (drawing) thread */
+#define THREAD_ROLES 3 /*!< number of thread roles */
+#define PARKED_WORKERS 2 /*!< threads parking between games (ai, ball) */
+#define SOAK_TICK_US 1000 /*!< time in us between updates in soak mode */
+#define AI_NAME_SIZE 16 /*!< max length of an ai preset name, with nul */
+#define BALL_IN 0 /*!< the ball is still in the field */
+#define BALL_OUT 1 /*!< the ball is out, the game is over */
+#define POOL_CELL_SIZE 2 /*!< side of a grid cell, twice a ball */
+#define POOL_MAX_CELLS (1 << 20) /*!< max cells of the spatial hash grid */
 
 #define MAX(a,b) ((a) > (b) ? (a) : (b)) /*!< return maximum of 2 values */
 #define MIN(a,b) ((a) < (b) ? (a) : (b)) /*!< return minimum of 2 values */
@@ -60,6 +84,74 @@
 extern char del[4]; /*!< delay time for repetition after key press */
 extern char rate[3]; /*!< rate (press/s) for a repeated key */
 
+/*!
+ * Parameters of an ai paddle policy
+ */
+typedef struct {
+    char name[AI_NAME_SIZE]; /*!< preset name */
+    int reaction; /*!< ticks between the ball moving and the ai seeing it */
+    int speed; /*!< percent of ticks the paddle moves toward its target */
+    int depth; /*!< ticks of ball trajectory predicted ahead */
+} ai_policy;
+
+/*!
+ * A ball of the multi-ball pool
+ */
+typedef struct {
+    int x; /*!< current x (column) coord */
+    int y; /*!< current y (row) coord */
+    int dirx; /*!< x speed component, 0 once the ball is out */
+    int diry; /*!< y speed component */
+} ball_state;
+
+/*!
+ * Pool of balls for the multi-ball mode. Balls in play are contiguous at
+ * the start of the pool; the spatial hash is a uniform grid over the 
+ * field, rebuilt every tick with a counting sort into arrays allocated 
+ * on layout.
+ */
+typedef struct {
+    ball_state *ball; /*!< balls, the first count are in play */
+    int count; /*!< balls in play */
+    int capacity; /*!< size of the pool */
+    int collide; /*!< enable ball-ball collisions */
+    int respawn; /*!< respawn balls which get out (benchmark) */
+    int cell_size; /*!< field columns and rows per grid cell */
+    int grid_cols; /*!< columns of the grid */
+    int grid_rows; /*!< rows of the grid */
+    int *cell_start; /*!< first slot of each cell, and one past the last */
+    int cells_size; /*!< size of cell_start */
+    int *cell_ball; /*!< ball indexes sorted by cell */
+    int *ball_cell; /*!< grid cell of each ball */
+    int lost[2]; /*!< balls missed by the player (0) and the ai (1) */
+    ball_state lead[2]; /*!< ball followed by the ai (0) and player (1) 
+                          paddle */
+    unsigned int seed; /*!< random seed for spawning */
+    int *drawn_x; /*!< columns drawn in the last frame */
+    int *drawn_y; /*!< rows drawn in the last frame */
+    int drawn; /*!< cells drawn in the last frame */
+    unsigned char *mask; /*!< sub-rows of each screen cell, high res */
+    int mask_size; /*!< size of mask */
+} ball_pool;
+
+/*!
+ * Options selected from the command line
+ */
+typedef struct {
+    int cpu[THREAD_ROLES]; /*!< cpu for each thread role, -1 for no pinning */
+    int realtime; /*!< request SCHED_FIFO scheduling and locked memory */
+    int jitter_report; /*!< print ball tick jitter distribution on exit */
+    int stats_summary; /*!< print per-thread accounting on exit */
+    int vscale; /*!< simulation rows per terminal row (1, 2 or 4) */
+    long soak_matches; /*!< ai-vs-ai matches to play, 0 for normal game */
+    ai_policy ai; /*!< policy of the ai paddle */
+    ai_policy autopilot; /*!< policy of the player paddle in soak mode */
+    int balls; /*!< balls of the multi-ball mode, 0 for the classic ball */
+    int ball_collisions; /*!< balls collide with each other */
+    int rewind_seconds; /*!< span of the rewind buffer, 0 for no rewind */
+    const char *metrics_path; /*!< metrics socket, NULL for no metrics */
+} game_options;
+
 /*!
  * Game data shared between threads 
  */
@@ -83,7 +175,20 @@ typedef struct {
     int termination_flag; /*!< request child threads termination */
     int winner; /*!< 0 for player, 1 for ai */
     int signal_fd; /*!< file descriptor for signal info pipe */
-    int bottom_row; /*!< last row of the gaming field = getmaxy(stdscr) */
+    int bottom_row; /*!< last row of the gaming field 
+                      = getmaxy(stdscr) * opt.vscale - 1 */
+    game_options opt; /*!< command line options */
+    int stats_flag; /*!< show the stats overlay */
+    atomic_int resize_pending; /*!< a window resize awaits re-layout */
+    int tick_us; /*!< time in us between ball position updates */
+    int ai_tick_us; /*!< time in us between ai position updates */
+    pthread_mutex_t park_mut; /*!< mutex for parking workers */
+    pthread_cond_t park_cond; /*!< signals game start and worker parking */
+    int game; /*!< number of games started */
+    int parked; /*!< workers parked waiting for the next game */
+    ball_pool pool; /*!< balls of the multi-ball mode */
+    atomic_int rewind_request; /*!< the player asked for a rewind */
+    int metrics_fd; /*!< listening metrics socket */
 } game_data;
 
 /*!
@@ -96,25 +201,128 @@ void *signal_listener(void*);
 /*!
  * \brief Manage window resize.
  *
+ * Re-layout the field for the current terminal size, rescaling the 
+ * position of paddles and ball. Must be called by the controller inside a
+ * critical section; resize events are coalesced into resize_pending, so 
+ * this runs at most once per frame.
+ *
  * @param data shared game_data structure
  */
 void resize_handler(game_data *data);
 
+/*!
+ * \brief Return the time elapsed between two instants, in microseconds.
+ *
+ * @param from start instant
+ * @param to end instant
+ * @return elapsed time in us
+ */
+long elapsed_us(const struct timespec *from, const struct timespec *to);
+
+/*!
+ * \brief Return the time elapsed between two instants, in nanoseconds.
+ *
+ * @param from start instant
+ * @param to end instant
+ * @return elapsed time in ns
+ */
+long elapsed_ns(const struct timespec *from, const struct timespec *to);
+
+/*!
+ * \brief Lock the ncurses mutex, counting contended acquisitions.
+ *
+ * @param data shared game_data structure
+ */
+void lock_game(game_data *data);
+
+/*!
+ * \brief Unlock the ncurses mutex.
+ *
+ * @param data shared game_data structure
+ */
+void unlock_game(game_data *data);
+
+/*!
+ * \brief Read a key without spinning on the terminal.
+ *
+ * Take a key from ncurses (critical section) and, if none is available,
+ * sleep on the terminal file descriptor for at most timeout milliseconds 
+ * before trying again.
+ *
+ * @param data shared game_data structure
+ * @param timeout max time to wait in milliseconds
+ * @return the key read, or ERR when no key has been pressed
+ */
+int read_key(game_data *data, int timeout);
+
+/*!
+ * \brief Park a worker until the next game starts.
+ *
+ * @param data shared game_data structure
+ * @param game last game played by the worker, updated to the new one
+ * @return non-zero to play the new game, zero when the program exits
+ */
+int wait_next_game(game_data *data, int *game);
+
+/*!
+ * \brief Wake the parked workers to play a new game.
+ *
+ * @param data shared game_data structure
+ */
+void start_game(game_data *data);
+
+/*!
+ * \brief Wait until all the workers are parked, so the game state can be
+ * set up for the next game.
+ *
+ * @param data shared game_data structure
+ */
+void wait_workers_parked(game_data *data);
+
+/*!
+ * \brief Ask all the worker threads to terminate.
+ *
+ * @param data shared game_data structure
+ */
+void stop_workers(game_data *data);
+
 /*!
  * \brief Thread function for keyboard input handling.
  *
- * The thread terminates itself when the termination_flag into game_data
- * structure is set to non-zero.
+ * The thread runs for the whole program life and terminates itself when 
+ * the exit_flag into game_data structure is set to non-zero.
  *
  * @param d shared game_data structure
  */
 void *keyboard_handler(void*);
 
+/*!
+ * \brief Put paddles and ball in their starting positions.
+ *
+ * The field size (bottom_row, paddle_col) must be already set.
+ *
+ * @param data game_data structure
+ * @param diry starting vertical direction of the ball (1 or -1)
+ */
+void reset_field(game_data *data, int diry);
+
+/*!
+ * \brief Advance the ball by one tick, reflecting it on borders and 
+ * paddles.
+ *
+ * When the ball gets out the winner field of game_data is set.
+ *
+ * @param data game_data structure
+ * @return BALL_IN, or BALL_OUT when the game is over
+ */
+int ball_step(game_data *data);
+
 /*!
  * \brief Thread function for ball position handling.
  *
- * The thread terminates itself when the ball reaches an invalid 
- * position 
+ * The game ends when the ball reaches an invalid position, then the 
+ * thread parks until the next game. It terminates when the exit_flag 
+ * into game_data structure is set to non-zero.
  *
  * @param d shared game_data structure
  */
@@ -123,8 +331,9 @@ void *ball_handler(void*);
 /*!
  * \brief Thread function for ball position generation.
  *
- * The thread terminates itself when the termination_flag into game_data
- * structure is set to non-zero.
+ * The thread parks between games, when the termination_flag into 
+ * game_data structure is set to non-zero, and terminates when the 
+ * exit_flag is set to non-zero.
  *
  * @param d shared game_data structure
  */
@@ -189,3 +398,5 @@ void print_intro_menu(WINDOW *win);
  * @param msg message to print in the sceen
  */
 void print_intra_menu(WINDOW *win, const char *msg);
+
+#endif /* SUPPORT_H */
@@ -0,0 +1,371 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <http://www.gnu.org/licenses/>.
+ *
+ * Copyright (C) Martino Pilia, 2014
+ */
+
+/*!
+ * \file tuner.c
+ * 
+ * \brief This file implements the self-play tuner of the ai presets.
+ *
+ * The search is a (mu+lambda) evolution strategy over the policy 
+ * parameters. Each generation the candidates play headless matches 
+ * against the human policy, on a field of a standard 80x24 terminal; 
+ * matches are split into chunks, which a pool of worker threads takes 
+ * from a shared counter.
+ */
+
+#include <time.h>
+#include <math.h>
+#include "ai.h"
+
+#define TUNE_COLS 80 /*!< columns of the headless field */
+#define TUNE_ROWS 24 /*!< rows of the headless field */
+#define TUNE_MAX_TICKS 20000 /*!< ticks before a match is a draw */
+#define TUNE_LAMBDA 16 /*!< candidates per generation */
+#define TUNE_MU 4 /*!< parents kept per generation */
+#define TUNE_GENERATIONS 20 /*!< generations per level */
+#define TUNE_MATCHES 2000 /*!< matches per candidate */
+#define TUNE_CHUNK 100 /*!< matches per work item */
+#define TUNE_CHUNKS (TUNE_MATCHES / TUNE_CHUNK) /*!< items per candidate */
+#define TUNE_ITEMS (TUNE_LAMBDA * TUNE_CHUNKS) /*!< items per generation */
+#define TUNE_SIGMA 0.3 /*!< starting step, as a share of each range */
+#define TUNE_DECAY 0.85 /*!< step decay per generation */
+#define TUNE_PARAMS 3 /*!< parameters searched */
+#define TUNE_PENALTY 0.02 /*!< fitness cost of a parameter at its bound */
+
+/* difficulty levels, with the win rate wanted against the human policy */
+static const char *level_name[] = {"easy", "medium", "hard", "expert"};
+static const double level_target[] = {0.25, 0.5, 0.75, 1.0};
+#define TUNE_LEVELS (int) (sizeof level_target / sizeof *level_target)
+
+/* bounds of each parameter (reaction, speed, depth); a paddle moving on 
+ * less than a third of the ticks only stutters, weakness must come from 
+ * reaction and depth */
+static const int param_min[TUNE_PARAMS] = {0, 30, 0};
+static const int param_max[TUNE_PARAMS] = 
+        {AI_MAX_REACTION, 100, AI_MAX_DEPTH};
+
+/* work shared with the pool for the current generation */
+static struct {
+    pthread_barrier_t start; /* generation ready, or tuning done */
+    pthread_barrier_t end; /* all work items done */
+    int done; /* set to stop the workers */
+    int level; /* level being tuned */
+    int gen; /* generation being played */
+    ai_policy cand[TUNE_LAMBDA]; /* candidates of the generation */
+    atomic_int next; /* next work item to take */
+    int score[TUNE_ITEMS]; /* half points won by each work item */
+} work;
+
+/*
+ * Play a headless match between a candidate on the ai side and the human
+ * policy. Return 2 if the candidate wins, 1 on a draw, 0 if it loses.
+ */
+static int play_match(const ai_policy *p, const ai_policy *human, 
+        unsigned int seed)
+{
+    game_data data;
+    ai_state ai;
+    ai_state player;
+    int t;
+
+    memset(&data, 0, sizeof data);
+    data.paddle_col = TUNE_COLS - 1;
+    data.ai_paddle_col = 1;
+    data.bottom_row = TUNE_ROWS - 1;
+    reset_field(&data, rand_r(&seed) % 2 == 0 ? 1 : -1);
+    ai_reset(&ai, &data, seed);
+    ai_reset(&player, &data, ~seed);
+
+    /* paddles move, then the ball, as ai and ball ticks do in game */
+    for (t = 0; t < TUNE_MAX_TICKS; ++t)
+    {
+        ai_move(p, &ai, &data, AI_SIDE);
+        ai_move(human, &player, &data, PLAYER_SIDE);
+        if (ball_step(&data) == BALL_OUT)
+            return data.winner == 1 ? 2 : 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Seed of a match chunk, fixed by level, generation, candidate and chunk,
+ * so that a run does not depend on the number of workers.
+ */
+static unsigned int chunk_seed(int level, int gen, int item)
+{
+    unsigned int h = 2166136261u;
+
+    h = (h ^ level) * 16777619u;
+    h = (h ^ gen) * 16777619u;
+    h = (h ^ item) * 16777619u;
+
+    return h;
+}
+
+/*
+ * Worker of the pool: play work items until the generation is done.
+ */
+static void *tune_worker(void *arg)
+{
+    ai_policy human;
+    unsigned int seed;
+    int item;
+    int i;
+
+    (void) arg;
+    ai_find_preset("human", &human);
+
+    for (;;)
+    {
+        pthread_barrier_wait(&work.start);
+        if (work.done)
+            break;
+
+        while ((item = atomic_fetch_add_explicit(&work.next, 1, 
+                        memory_order_relaxed)) < TUNE_ITEMS)
+        {
+            seed = chunk_seed(work.level, work.gen, item);
+            work.score[item] = 0;
+            for (i = 0; i < TUNE_CHUNK; ++i)
+                work.score[item] += play_match(
+                        &work.cand[item / TUNE_CHUNKS], &human, seed + i);
+        }
+
+        pthread_barrier_wait(&work.end);
+    }
+
+    return 0;
+}
+
+/*
+ * Gaussian sample with the Box-Muller transform.
+ */
+static double gauss(unsigned int *seed)
+{
+    double u = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+    double v = (rand_r(seed) + 1.0) / (RAND_MAX + 2.0);
+
+    return sqrt(-2.0 * log(u)) * cos(2.0 * M_PI * v);
+}
+
+/*
+ * Set a policy from a parameter vector, rounded and clamped.
+ */
+static void set_policy(ai_policy *p, const double *x)
+{
+    int v[TUNE_PARAMS];
+    int i;
+
+    for (i = 0; i < TUNE_PARAMS; ++i)
+        v[i] = MAX(param_min[i], MIN((int) lround(x[i]), param_max[i]));
+    p->reaction = v[0];
+    p->speed = v[1];
+    p->depth = v[2];
+}
+
+/*
+ * Cost of a parameter vector, growing with the square of the distance of 
+ * each parameter from the middle of its range. Many vectors hit a win rate
+ * within the noise of the matches: the cost keeps the search away from 
+ * the bounds, where a policy is degenerate (a paddle which never sees the
+ * ball, or which seldom moves).
+ */
+static double penalty(const double *x)
+{
+    double d;
+    double sum = 0.0;
+    int i;
+
+    for (i = 0; i < TUNE_PARAMS; ++i)
+    {
+        d = 2.0 * (x[i] - param_min[i]) / (param_max[i] - param_min[i]) - 1;
+        sum += d * d;
+    }
+
+    return TUNE_PENALTY * sum / TUNE_PARAMS;
+}
+
+static double elapsed_s(const struct timespec *from)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec - from->tv_sec + (now.tv_nsec - from->tv_nsec) / 1e9;
+}
+
+/*
+ * Run the evolution strategy for a level, with the pool already started.
+ * Fill the best policy found and its win rate.
+ */
+static void tune_level(int level, int workers, ai_policy *best, 
+        double *best_rate, unsigned int *seed)
+{
+    double parent[TUNE_MU][TUNE_PARAMS]; /* parent parameters */
+    double parent_fit[TUNE_MU]; /* parent fitness */
+    double parent_rate[TUNE_MU]; /* parent win rate */
+    double child[TUNE_LAMBDA][TUNE_PARAMS]; /* candidate parameters */
+    double fit; /* candidate fitness */
+    double rate; /* candidate win rate */
+    double sigma = TUNE_SIGMA; /* step, as a share of each range */
+    struct timespec t0; /* generation start */
+    double secs; /* generation duration */
+    int score;
+    int gen;
+    int i, j, k;
+
+    /* start from random parents, with no fitness yet */
+    for (i = 0; i < TUNE_MU; ++i)
+    {
+        for (j = 0; j < TUNE_PARAMS; ++j)
+            parent[i][j] = param_min[j] 
+                + rand_r(seed) % (param_max[j] - param_min[j] + 1);
+        parent_fit[i] = -INFINITY;
+        parent_rate[i] = 0.0;
+    }
+
+    work.level = level;
+    for (gen = 0; gen < TUNE_GENERATIONS; ++gen)
+    {
+        /* mutate parents in turn */
+        for (i = 0; i < TUNE_LAMBDA; ++i)
+        {
+            for (j = 0; j < TUNE_PARAMS; ++j)
+                child[i][j] = MAX((double) param_min[j], 
+                        MIN(parent[i % TUNE_MU][j] + sigma 
+                            * (param_max[j] - param_min[j]) * gauss(seed), 
+                        (double) param_max[j]));
+            snprintf(work.cand[i].name, AI_NAME_SIZE, "%s", 
+                    level_name[level]);
+            set_policy(&work.cand[i], child[i]);
+        }
+
+        /* play the generation on the pool */
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        work.gen = gen;
+        atomic_store(&work.next, 0);
+        pthread_barrier_wait(&work.start);
+        pthread_barrier_wait(&work.end);
+        secs = elapsed_s(&t0);
+
+        /* keep the best mu among parents and candidates (elitism) */
+        for (i = 0; i < TUNE_LAMBDA; ++i)
+        {
+            for (score = 0, k = 0; k < TUNE_CHUNKS; ++k)
+                score += work.score[i * TUNE_CHUNKS + k];
+            rate = score / (2.0 * TUNE_MATCHES);
+            fit = -fabs(rate - level_target[level]) - penalty(child[i]);
+
+            for (k = TUNE_MU - 1; k >= 0 && fit > parent_fit[k]; --k)
+                if (k < TUNE_MU - 1)
+                {
+                    parent_fit[k + 1] = parent_fit[k];
+                    parent_rate[k + 1] = parent_rate[k];
+                    memcpy(parent[k + 1], parent[k], sizeof parent[k]);
+                }
+            if (++k < TUNE_MU)
+            {
+                parent_fit[k] = fit;
+                parent_rate[k] = rate;
+                memcpy(parent[k], child[i], sizeof parent[k]);
+            }
+        }
+
+        set_policy(best, parent[0]);
+        fprintf(stderr, "%-6s gen %2d: best %2d %3d %3d, win rate %.3f; "
+                "%.0f matches/s, %.0f per core\n",
+                level_name[level], gen, best->reaction, best->speed, 
+                best->depth, parent_rate[0], 
+                TUNE_LAMBDA * TUNE_MATCHES / secs,
+                TUNE_LAMBDA * TUNE_MATCHES / secs / workers);
+
+        sigma *= TUNE_DECAY;
+    }
+
+    snprintf(best->name, AI_NAME_SIZE, "%s", level_name[level]);
+    *best_rate = parent_rate[0];
+}
+
+int ai_tune(const char *path)
+{
+    pthread_t *pool; /* worker threads */
+    ai_policy best[TUNE_LEVELS]; /* preset found for each level */
+    double rate[TUNE_LEVELS]; /* win rate of each preset */
+    unsigned int seed = 1; /* seed of the search, fixed for repeatability */
+    struct timespec t0; /* tuning start */
+    double secs; /* tuning duration */
+    long workers = MAX(sysconf(_SC_NPROCESSORS_ONLN), 1);
+    FILE *f;
+    int i;
+
+    if (!(f = fopen(path, "w")))
+        return -1;
+    if (!(pool = malloc(workers * sizeof *pool)))
+    {
+        fclose(f);
+        return -1;
+    }
+
+    /* start the pool, the main thread only hands out generations */
+    work.done = 0;
+    pthread_barrier_init(&work.start, NULL, workers + 1);
+    pthread_barrier_init(&work.end, NULL, workers + 1);
+    for (i = 0; i < workers; ++i)
+    {
+        /* the barriers count on every worker: no way to go on with less */
+        int err = pthread_create(&pool[i], NULL, tune_worker, NULL);
+        if (err)
+        {
+            fprintf(stderr, "cannot create tuner worker: %s\n", 
+                    strerror(err));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    fprintf(stderr, "tuning %d levels on %ld workers, %d matches per "
+            "generation\n", TUNE_LEVELS, workers, TUNE_LAMBDA * TUNE_MATCHES);
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < TUNE_LEVELS; ++i)
+        tune_level(i, workers, &best[i], &rate[i], &seed);
+    secs = elapsed_s(&t0);
+
+    /* stop the pool */
+    work.done = 1;
+    pthread_barrier_wait(&work.start);
+    for (i = 0; i < workers; ++i)
+        pthread_join(pool[i], NULL);
+    pthread_barrier_destroy(&work.start);
+    pthread_barrier_destroy(&work.end);
+    free(pool);
+
+    fprintf(stderr, "%d matches in %.1f s: %.0f matches/s, %.0f per core\n",
+            TUNE_LEVELS * TUNE_GENERATIONS * TUNE_LAMBDA * TUNE_MATCHES, 
+            secs, 
+            TUNE_LEVELS * TUNE_GENERATIONS * TUNE_LAMBDA * TUNE_MATCHES / secs,
+            TUNE_LEVELS * TUNE_GENERATIONS * TUNE_LAMBDA * TUNE_MATCHES 
+                / secs / workers);
+
+    fprintf(f, "# pong ai presets, written by pong -T\n"
+            "# name reaction speed depth  # win rate against 'human' "
+            "on %dx%d\n", TUNE_COLS, TUNE_ROWS);
+    for (i = 0; i < TUNE_LEVELS; ++i)
+        fprintf(f, "%-8s %2d %3d %3d  # %.3f\n", best[i].name, 
+                best[i].reaction, best[i].speed, best[i].depth, rate[i]);
+
+    return fclose(f) ? -1 : 0;
+}